@@ -20,8 +20,8 @@ LModelAudioProcessorEditor::LModelAudioProcessorEditor(LModelAudioProcessor& p)
 	setOpaque(false);  // ڱ߿
 
 	//setResizeLimits(64 * 11, 64 * 5, 10000, 10000); // СΪ300x200Ϊ800x600
-	setSize(64 * 8, 64 * 2);
-	setResizeLimits(64 * 8, 64 * 2, 64 * 13, 64 * 2);
+	setSize(64 * 15, 64 * 2);
+	setResizeLimits(64 * 15, 64 * 2, 64 * 16, 64 * 2);
 
 	//constrainer.setFixedAspectRatio(11.0 / 4.0);  // Ϊ16:9
 	//setConstrainer(&constrainer);  // 󶨴ڵĿ
@@ -47,6 +47,27 @@ LModelAudioProcessorEditor::LModelAudioProcessorEditor(LModelAudioProcessor& p)
 	K_DampHigh.setText("damp", "");
 	K_DampHigh.ParamLink(audioProcessor.GetParams(), "damp_high");
 	addAndMakeVisible(K_DampHigh);
+	K_Poly.setText("poly", "");
+	K_Poly.ParamLink(audioProcessor.GetParams(), "poly");
+	addAndMakeVisible(K_Poly);
+	K_Quality.setText("quality", "");
+	K_Quality.ParamLink(audioProcessor.GetParams(), "quality");
+	addAndMakeVisible(K_Quality);
+	K_Oversampling.setText("oversample", "");
+	K_Oversampling.ParamLink(audioProcessor.GetParams(), "oversampling");
+	addAndMakeVisible(K_Oversampling);
+	K_Engine.setText("engine", "");
+	K_Engine.ParamLink(audioProcessor.GetParams(), "engine");
+	addAndMakeVisible(K_Engine);
+	K_Strings.setText("strings", "");
+	K_Strings.ParamLink(audioProcessor.GetParams(), "strings");
+	addAndMakeVisible(K_Strings);
+	K_Threads.setText("threads", "");
+	K_Threads.ParamLink(audioProcessor.GetParams(), "threads");
+	addAndMakeVisible(K_Threads);
+	K_Rate.setText("rate", "");
+	K_Rate.ParamLink(audioProcessor.GetParams(), "rate");
+	addAndMakeVisible(K_Rate);
 
 
 	startTimerHz(30);
@@ -84,6 +105,13 @@ void LModelAudioProcessorEditor::resized()
 	K_Unison.setBounds(32 + 64 * 4, 32, 64, 64);
 	K_DampBase.setBounds(32 + 64 * 5, 32, 64, 64);
 	K_DampHigh.setBounds(32 + 64 * 6, 32, 64, 64);
+	K_Poly.setBounds(32 + 64 * 7, 32, 64, 64);
+	K_Quality.setBounds(32 + 64 * 8, 32, 64, 64);
+	K_Oversampling.setBounds(32 + 64 * 9, 32, 64, 64);
+	K_Engine.setBounds(32 + 64 * 10, 32, 64, 64);
+	K_Strings.setBounds(32 + 64 * 11, 32, 64, 64);
+	K_Threads.setBounds(32 + 64 * 12, 32, 64, 64);
+	K_Rate.setBounds(32 + 64 * 13, 32, 64, 64);
 
 }
 
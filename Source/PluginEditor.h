@@ -37,6 +37,13 @@ private:
 	LMKnob K_Unison;
 	LMKnob K_DampBase;
 	LMKnob K_DampHigh;
+	LMKnob K_Poly;
+	LMKnob K_Quality;
+	LMKnob K_Oversampling;
+	LMKnob K_Engine;
+	LMKnob K_Strings;
+	LMKnob K_Threads;
+	LMKnob K_Rate;
 
 
 	juce::ComponentBoundsConstrainer constrainer;  // ÿ߱
@@ -30,13 +30,22 @@ LModelAudioProcessor::LModelAudioProcessor()
 juce::AudioProcessorValueTreeState::ParameterLayout LModelAudioProcessor::createParameterLayout()
 {
 	juce::AudioProcessorValueTreeState::ParameterLayout layout;
-	layout.add(std::make_unique<juce::AudioParameterFloat>("pitch", "pitch", -48, 48, 0));
+	layout.add(std::make_unique<juce::AudioParameterFloat>("pitch", "pitch", LMEpianoPoly::MinPitch, LMEpianoPoly::MaxPitch, 0));
 	layout.add(std::make_unique<juce::AudioParameterFloat>("disp", "disp", 0, 1, 0));
 	layout.add(std::make_unique<juce::AudioParameterFloat>("nlv", "nlv", 0, 1, 0));
 	layout.add(std::make_unique<juce::AudioParameterFloat>("cross", "cross", 0, 1, 0.35));
 	layout.add(std::make_unique<juce::AudioParameterFloat>("unison", "unison", 0, 1, 0.5));
 	layout.add(std::make_unique<juce::AudioParameterFloat>("damp_base", "damp_base", 0, 1, 0.25));
 	layout.add(std::make_unique<juce::AudioParameterFloat>("damp_high", "damp_high", 0, 1, 0.25));
+	layout.add(std::make_unique<juce::AudioParameterInt>("poly", "poly", 1, MaxNumPolys, DefaultNumPolys));
+	layout.add(std::make_unique<juce::AudioParameterChoice>("quality", "quality", juce::StringArray{ "eco", "standard", "high" }, LMEpianoPoly::QualityStandard));
+	layout.add(std::make_unique<juce::AudioParameterChoice>("oversampling", "oversampling", juce::StringArray{ "1x", "2x", "4x" }, 0));
+	layout.add(std::make_unique<juce::AudioParameterChoice>("engine", "engine", juce::StringArray{ "waveguide", "fdtd" }, LMEpianoPoly::EngineWaveguide));
+	layout.add(std::make_unique<juce::AudioParameterChoice>("strings", "strings", juce::StringArray{ "trichords", "piano" }, LMEpianoPoly::StringsTrichords));
+	//0 renders every voice in the audio callback
+	layout.add(std::make_unique<juce::AudioParameterInt>("threads", "threads", 0, LMEpianoPoly::MaxRenderThreads, 0));
+	//engine rate when the host runs faster, the resampler latency is reported to the host
+	layout.add(std::make_unique<juce::AudioParameterChoice>("rate", "rate", juce::StringArray{ "host", "44100", "48000" }, 0));
 	return layout;
 }
 
@@ -110,12 +119,35 @@ void LModelAudioProcessor::changeProgramName(int index, const juce::String& newN
 //==============================================================================
 void LModelAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
+	//Prepare() allocates the voices of the string engine, starts the render
+	//threads and sets up the resampler to the engine rate, later changes of
+	//any of them prepare again from handleAsyncUpdate()
+	paramHandles.Update(paramSnapshot);
+	epianos.SetParams(paramSnapshot);
+	epianos.Prepare(sampleRate, samplesPerBlock);
+	setLatencySamples(epianos.GetLatencySamples());
+	preparedRate = sampleRate;
+	preparedBlockSize = samplesPerBlock;
+}
+
+void LModelAudioProcessor::handleAsyncUpdate()
+{
+	if (preparedRate <= 0) return;
+	//waits for a running processBlock, the host skips it while suspended
+	suspendProcessing(true);
+	if (epianos.NeedsPrepare())
+	{
+		epianos.Prepare(preparedRate, preparedBlockSize);
+		setLatencySamples(epianos.GetLatencySamples());
+	}
+	suspendProcessing(false);
 }
 
 void LModelAudioProcessor::releaseResources()
 {
 	// When playback stops, you can use this as an opportunity to free up any
 	// spare memory, etc.
+	epianos.Release();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -147,44 +179,46 @@ bool LModelAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) co
 
 void LModelAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
-	int isMidiUpdata = 0;
-	juce::MidiMessage MidiMsg;//ȴmidi¼
+	const int numSamples = buffer.getNumSamples();
+	float* wavbufl = buffer.getWritePointer(0);
+	float* wavbufr = buffer.getWritePointer(1);
+
+	//the dsp only sees a new snapshot when some parameter moved
+	if (paramHandles.Update(paramSnapshot))
+	{
+		epianos.SetParams(paramSnapshot);
+		if (epianos.NeedsPrepare()) triggerAsyncUpdate();
+	}
+
+	//render between midi events so every note starts on its own sample,
+	//events closer than MinSubBlock to the last split are applied at that split
+	int renderPos = 0;
+	juce::MidiMessage MidiMsg;
 	int MidiTime;
 	juce::MidiBuffer::Iterator MidiBuf(midiMessages);
 	while (MidiBuf.getNextEvent(MidiMsg, MidiTime))
 	{
+		if (MidiTime >= numSamples) MidiTime = numSamples - 1;
+		if (MidiTime - renderPos >= MinSubBlock)
+		{
+			epianos.ProcessBlock(wavbufl + renderPos, wavbufr + renderPos, MidiTime - renderPos);
+			renderPos = MidiTime;
+		}
 		if (MidiMsg.isNoteOn())
 		{
-			int note = MidiMsg.getNoteNumber() - 24;
+			int note = MidiMsg.getNoteNumber();
 			epianos.NoteOn(note, MidiMsg.getFloatVelocity());
-			//throw "test";
 		}
 		if (MidiMsg.isNoteOff())
 		{
-			int note = MidiMsg.getNoteNumber() - 24;
+			int note = MidiMsg.getNoteNumber();
 			epianos.NoteOff(note);
 		}
 	}
 	midiMessages.clear();
 
-	const int numSamples = buffer.getNumSamples();
-	float* wavbufl = buffer.getWritePointer(0);
-	float* wavbufr = buffer.getWritePointer(1);
-	const float* recbufl = buffer.getReadPointer(0);
-	const float* recbufr = buffer.getReadPointer(1);
-
-	float SampleRate = getSampleRate();
-
-	float pitch = *Params.getRawParameterValue("pitch");
-	float disp = *Params.getRawParameterValue("disp");
-	float nlv = *Params.getRawParameterValue("nlv");
-	float cross = *Params.getRawParameterValue("cross");
-	float unison = *Params.getRawParameterValue("unison");
-	float damp_base = *Params.getRawParameterValue("damp_base");
-	float damp_high = *Params.getRawParameterValue("damp_high");
-
-	epianos.SetStringParams(powf(2.0f, (pitch + 24.0) / 12.0f), disp, nlv, cross, unison, damp_base, damp_high);
-	epianos.ProcessBlock(wavbufl, wavbufr, numSamples);
+	if (renderPos < numSamples)
+		epianos.ProcessBlock(wavbufl + renderPos, wavbufr + renderPos, numSamples - renderPos);
 }
 
 //==============================================================================
@@ -13,8 +13,79 @@
 
 //==============================================================================
 /**
+	the parameter atomics resolved once, so processBlock never looks a
+	parameter up by name. Every change (host automation, editor, state load)
+	bumps a version counter from whatever thread it happens on; Update() reads
+	the values only when the version moved since its last call.
 */
-class LModelAudioProcessor : public juce::AudioProcessor
+class ParamHandles : private juce::AudioProcessorValueTreeState::Listener
+{
+public:
+	ParamHandles(juce::AudioProcessorValueTreeState& state) : state(state)
+	{
+		for (int i = 0; i < NumParams; ++i)
+		{
+			values[i] = state.getRawParameterValue(Ids[i]);
+			jassert(values[i] != nullptr);
+			state.addParameterListener(Ids[i], this);
+		}
+	}
+	~ParamHandles() override
+	{
+		for (int i = 0; i < NumParams; ++i)
+			state.removeParameterListener(Ids[i], this);
+	}
+	// refreshes p and returns true when a parameter changed since the last
+	// call, audio thread only
+	bool Update(LMEpianoParams& p)
+	{
+		unsigned v = version.load(std::memory_order_acquire);
+		if (v == seen) return false;
+		seen = v;
+		p.pitch = powf(2.0f, Get(Pitch) / 12.0f);
+		p.disp = Get(Disp);
+		p.nlv = Get(Nlv);
+		p.cross = Get(Cross);
+		p.unison = Get(Unison);
+		p.damp_base = Get(DampBase);
+		p.damp_high = Get(DampHigh);
+		p.poly = (int)Get(Poly);
+		p.quality = (int)Get(Quality);
+		p.oversampling = 1 << (int)Get(Oversampling);
+		p.engine = (int)Get(Engine);
+		p.strings = (int)Get(Strings);
+		p.threads = (int)Get(Threads);
+		p.internalRate = InternalRates[(int)Get(Rate)];
+		return true;
+	}
+
+private:
+	enum { Pitch, Disp, Nlv, Cross, Unison, DampBase, DampHigh, Poly, Quality, Oversampling, Engine, Strings, Threads, Rate, NumParams };
+	static constexpr const char* Ids[NumParams] = { "pitch", "disp", "nlv", "cross", "unison", "damp_base", "damp_high", "poly", "quality", "oversampling", "engine", "strings", "threads", "rate" };
+	//choices of the rate parameter, 0 renders at the host rate
+	static constexpr float InternalRates[] = { 0, 44100, 48000 };
+
+	juce::AudioProcessorValueTreeState& state;
+	std::atomic<float>* values[NumParams];
+	std::atomic<unsigned> version{ 1 };
+	unsigned seen = 0;
+
+	float Get(int i) const
+	{
+		return values[i]->load(std::memory_order_relaxed);
+	}
+	void parameterChanged(const juce::String&, float) override
+	{
+		version.fetch_add(1, std::memory_order_release);
+	}
+
+	JUCE_DECLARE_NON_COPYABLE(ParamHandles)
+};
+
+//==============================================================================
+/**
+*/
+class LModelAudioProcessor : public juce::AudioProcessor, private juce::AsyncUpdater
 {
 public:
 
@@ -67,9 +138,21 @@ private:
 	//Synth Param
 	static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 	juce::AudioProcessorValueTreeState Params{ *this, nullptr, "Parameters", createParameterLayout() };
+	ParamHandles paramHandles{ Params };
+	LMEpianoParams paramSnapshot;
 
 	float freq = 1.0;
 	LMEpianoPoly epianos;
+	//what the last prepareToPlay() got, handleAsyncUpdate() prepares again with it
+	double preparedRate = 0;
+	int preparedBlockSize = 0;
+
+	//prepares again when a setting that only takes effect at Prepare() (engine,
+	//render threads, engine rate) changed
+	void handleAsyncUpdate() override;
+
+	//smallest sub-block processBlock splits at for midi events (~0.7ms at 48k)
+	constexpr static int MinSubBlock = 32;
 
 	//==============================================================================
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LModelAudioProcessor)
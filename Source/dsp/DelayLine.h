@@ -2,12 +2,101 @@
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <vector>
+#include "SimdVec.h"
 
-template<int MaxDelayLen>
+enum class Interpolation
+{
+	Linear,  // 2 taps, cheapest, lowpasses the loop the most
+	Hermite, // 4 taps
+	Thiran,  // first order allpass, flat magnitude, exact delay at low frequencies
+	Sinc     // 8 tap Kaiser windowed sinc from a table, flat and linear phase to ~0.4 fs
+};
+
+// windowed sinc fractional delay coefficients, Phases + 1 rows of Taps
+// weights built once on first use (Prepare time, never in the audio loop).
+// Every row is scaled so its magnitude response peaks at exactly 1, the loop
+// gain therefore never exceeds what the other filters allow.
+class SincTable
+{
+public:
+	constexpr static int Taps = 8;
+	constexpr static int Phases = 1024;
+private:
+	alignas(32) float coef[(Phases + 1) * Taps];
+
+	static double BesselI0(double x)
+	{
+		double sum = 1, term = 1;
+		for (int k = 1; k < 32; ++k)
+		{
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+	SincTable()
+	{
+		const double beta = 6.0, cutoff = 0.92;
+		for (int p = 0; p <= Phases; ++p)
+		{
+			double frac = (double)p / Phases;
+			double h[Taps];
+			for (int j = 0; j < Taps; ++j)
+			{
+				// tap j is Taps / 2 - j samples newer than the integer delay
+				double t = (double)(Taps / 2 - j) - frac;
+				double sinc = t == 0 ? cutoff : sin(M_PI * cutoff * t) / (M_PI * t);
+				double w = t / (Taps / 2);
+				h[j] = fabs(w) >= 1 ? 0 : sinc * BesselI0(beta * sqrt(1 - w * w)) / BesselI0(beta);
+			}
+			double peak = 0;
+			for (int k = 0; k <= 128; ++k)
+			{
+				double om = M_PI * k / 128, re = 0, im = 0;
+				for (int j = 0; j < Taps; ++j)
+				{
+					re += h[j] * cos(om * j);
+					im -= h[j] * sin(om * j);
+				}
+				peak = fmax(peak, sqrt(re * re + im * im));
+			}
+			for (int j = 0; j < Taps; ++j) coef[p * Taps + j] = (float)(h[j] / peak);
+		}
+	}
+public:
+	static const SincTable& Get()
+	{
+		static const SincTable table;
+		return table;
+	}
+	// weights for fractional delay frac in [0, 1), nearest of the table phases
+	static inline const float* Row(float frac)
+	{
+		return &Get().coef[(int)(frac * Phases + 0.5f) * Taps];
+	}
+	static inline float Dot(const float* y, const float* h)
+	{
+		VecN acc = VecN::Zero();
+		for (int j = 0; j < Taps; j += VecN::Width)
+			acc = acc + VecN::LoadU(y + j) * VecN::Load(h + j);
+		return acc.Sum();
+	}
+};
+
+// runtime-sized ring buffer, the capacity is rounded up to a power of two so
+// every index wraps with a single mask. The read position is split into the
+// integer and fractional part of the delay, so the interpolation fraction keeps
+// full float precision independent of the write position.
+// Once the smoothed delay stops moving the line is 'settled': the smoothing
+// update is skipped, and for delays longer than a block ReadBlock()/WriteBlock()
+// process the block in straight loops the compiler can vectorise.
 class DelayLine
 {
 private:
-	float dat[MaxDelayLen] = { 0 };
+	std::vector<float> dat;
+	int size = 0;
+	int mask = 0;
 	float out = 0;
 
 	// ƽ
@@ -16,25 +105,16 @@ private:
 	float delayVelocity = 0; // ƽӳʱ䱾
 
 	int pos = 0;
+	int written = 0; // samples written since the last Reset(), saturates at size
+	bool settled = false; // currentDelay reached its fixed point
 
-	inline float ReadSampleHermite(float delay)
-	{
-		float readPos = (float)pos - delay;
-		while (readPos < 0) readPos += MaxDelayLen;
-		while (readPos >= MaxDelayLen) readPos -= MaxDelayLen;
-
-		int i1 = (int)readPos;
-		float f = readPos - i1;
-
-		int i0 = (i1 - 1 + MaxDelayLen) % MaxDelayLen;
-		int i2 = (i1 + 1) % MaxDelayLen;
-		int i3 = (i1 + 2) % MaxDelayLen;
-
-		float y0 = dat[i0];
-		float y1 = dat[i1];
-		float y2 = dat[i2];
-		float y3 = dat[i3];
+	Interpolation interpolation = Interpolation::Hermite;
+	float thiranZ = 0;
+	float thiranA = 0;
+	float thiranDelay = -1; // delay thiranA was computed for
 
+	static inline float Hermite(float y0, float y1, float y2, float y3, float f)
+	{
 		float c0 = y1;
 		float c1 = 0.5f * (y2 - y0);
 		float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
@@ -42,30 +122,163 @@ private:
 
 		return ((c3 * f + c2) * f + c1) * f + c0;
 	}
-	inline float ReadSampleLinear(float delay)
+	// the same operations on VecN::Width consecutive outputs
+	static inline VecN Hermite(VecN y0, VecN y1, VecN y2, VecN y3, VecN f)
+	{
+		VecN c0 = y1;
+		VecN c1 = VecN::Set(0.5f) * (y2 - y0);
+		VecN c2 = y0 - VecN::Set(2.5f) * y1 + VecN::Set(2.0f) * y2 - VecN::Set(0.5f) * y3;
+		VecN c3 = VecN::Set(0.5f) * (y3 - y0) + VecN::Set(1.5f) * (y1 - y2);
+
+		return ((c3 * f + c2) * f + c1) * f + c0;
+	}
+
+	// tap 'age' samples before the newest one, with Fresh set taps written
+	// before the last Reset() read as 0
+	template<bool Fresh>
+	inline float Tap(int age) const
+	{
+		if (Fresh && age >= written) return 0.0f;
+		return dat[(pos - age) & mask];
+	}
+	template<bool Fresh>
+	inline float ReadHermite(float delay)
+	{
+		int di = (int)delay;
+		float f = 1.0f - (delay - di);
+		return Hermite(Tap<Fresh>(di + 2), Tap<Fresh>(di + 1), Tap<Fresh>(di), Tap<Fresh>(di - 1), f);
+	}
+	template<bool Fresh>
+	inline float ReadLinear(float delay)
+	{
+		int di = (int)delay;
+		float f = 1.0f - (delay - di);
+		return Tap<Fresh>(di + 1) * (1.0f - f) + Tap<Fresh>(di) * f;
+	}
+	// first order allpass, the integer part is chosen so its own delay stays
+	// in [0.5, 1.5) where the coefficient is in (-0.2, 0.34]
+	template<bool Fresh>
+	inline float ReadThiran(float delay)
+	{
+		int m = (int)(delay - 0.5f);
+		if (delay != thiranDelay)
+		{
+			float d = delay - m;
+			thiranA = (1.0f - d) / (1.0f + d);
+			thiranDelay = delay;
+		}
+		thiranZ = thiranA * (Tap<Fresh>(m) - thiranZ) + Tap<Fresh>(m + 1);
+		return thiranZ;
+	}
+	template<bool Fresh>
+	inline float ReadSinc(float delay)
 	{
-		float readPos = (float)pos - delay;
-		while (readPos < 0) readPos += MaxDelayLen;
-		while (readPos >= MaxDelayLen) readPos -= MaxDelayLen;
-		int i1 = (int)readPos;
-		int i2 = (i1 + 1) % MaxDelayLen;
-		float f = readPos - i1;
-		return dat[i1] * (1.0f - f) + dat[i2] * f;
+		int di = (int)delay;
+		if (di < SincTable::Taps / 2 - 1) return ReadHermite<Fresh>(delay);
+		const float* h = SincTable::Row(delay - di);
+		int first = (pos - di - SincTable::Taps / 2) & mask; // oldest tap
+		if (!Fresh && first + SincTable::Taps <= size)
+			return SincTable::Dot(&dat[first], h);
+		alignas(32) float y[SincTable::Taps];
+		for (int j = 0; j < SincTable::Taps; ++j)
+			y[j] = Tap<Fresh>(di + SincTable::Taps / 2 - j);
+		return SincTable::Dot(y, h);
+	}
+	// Mode is an Interpolation, or AnyMode to follow SetInterpolation()
+	constexpr static int AnyMode = -1;
+	template<bool Fresh, int Mode>
+	inline float Read(float delay)
+	{
+		if constexpr (Mode == (int)Interpolation::Linear) return ReadLinear<Fresh>(delay);
+		else if constexpr (Mode == (int)Interpolation::Thiran) return ReadThiran<Fresh>(delay);
+		else if constexpr (Mode == (int)Interpolation::Sinc) return ReadSinc<Fresh>(delay);
+		else if constexpr (Mode == (int)Interpolation::Hermite) return ReadHermite<Fresh>(delay);
+		else
+		{
+			switch (interpolation)
+			{
+			case Interpolation::Linear: return ReadLinear<Fresh>(delay);
+			case Interpolation::Thiran: return ReadThiran<Fresh>(delay);
+			case Interpolation::Sinc: return ReadSinc<Fresh>(delay);
+			default: return ReadHermite<Fresh>(delay);
+			}
+		}
+	}
+	template<int Mode>
+	inline void Write(float val)
+	{
+		dat[pos] = val;
+		if (written < size) written++;
+
+		if (!settled)
+		{
+			float next = currentDelay + delayVelocity * (targetDelay - currentDelay);
+			settled = next == currentDelay;
+			currentDelay = next;
+		}
+
+		// after a Reset() only the samples written since then are valid;
+		// once every tap is inside that region the plain read is used. The
+		// checked read only runs for one delay length after a reset, it stays
+		// generic so a fixed Mode only adds the plain read
+		if (written >= size || (currentDelay > 1.0f && currentDelay + Headroom / 2 < (float)written))
+			out = Read<false, Mode>(currentDelay);
+		else
+			out = Read<true, AnyMode>(currentDelay);
+
+		pos = (pos + 1) & mask;
 	}
 public:
 	constexpr static int GradientSamples = 50;
+	// samples the buffer holds beyond the longest delay
+	constexpr static int Headroom = SincTable::Taps;
+
+	DelayLine(int maxDelay = 0)
+	{
+		if (maxDelay > 0) Resize(maxDelay);
+	}
 
-	DelayLine()
+	// allocates the buffer, not real-time safe: call from prepareToPlay
+	void Resize(int maxDelay)
 	{
-		std::fill(dat, dat + MaxDelayLen, 0.0f);
+		int n = 4;
+		while (n < maxDelay + Headroom) n <<= 1;//room for the interpolation taps
+		size = n;
+		mask = n - 1;
+		dat.assign(n, 0.0f);
+		SincTable::Get(); // builds the table outside the audio callback
+		pos = 0;
+		written = 0;
+		out = 0;
+		if (targetDelay > GetMaxDelay()) targetDelay = GetMaxDelay();
+		if (currentDelay > GetMaxDelay()) currentDelay = GetMaxDelay();
+		settled = false;
+	}
+
+	float GetMaxDelay() const
+	{
+		return (float)(size - Headroom);
 	}
 
 	inline void SetDelayTime(float t)
 	{
+		if (t > GetMaxDelay()) t = GetMaxDelay();
+		if (t != targetDelay) settled = false;
 		targetDelay = t;
 		delayVelocity = 1.0 / (float)GradientSamples;
 	}
 
+	void SetInterpolation(Interpolation mode)
+	{
+		if (mode == interpolation) return;
+		interpolation = mode;
+		thiranZ = 0;
+	}
+	Interpolation GetInterpolation() const
+	{
+		return interpolation;
+	}
+
 	inline float ReadSample()
 	{
 		return out;
@@ -73,17 +286,68 @@ public:
 
 	inline void WriteSample(float val)
 	{
-		dat[pos] = val;
-
-		currentDelay += delayVelocity * (targetDelay - currentDelay);
-
-		out = ReadSampleHermite(currentDelay);
-
-		if (++pos >= MaxDelayLen) pos = 0;
+		Write<AnyMode>(val);
+	}
+	// WriteSample() with the kernel chosen at compile time, Mode must be the
+	// SetInterpolation() mode
+	template<Interpolation Mode>
+	inline void WriteSample(float val)
+	{
+		Write<(int)Mode>(val);
+	}
+	// true when the next numSamples outputs only read samples that are
+	// already written, i.e. the delay is settled and longer than the block.
+	// Only the Hermite kernel has a block path
+	inline bool CanReadBlock(int numSamples) const
+	{
+		return numSamples <= GetBlockLimit();
+	}
+	// longest block CanReadBlock() accepts now, 0 when there is no block path
+	inline int GetBlockLimit() const
+	{
+		if (!settled || interpolation != Interpolation::Hermite) return 0;
+		if (written < size && currentDelay + 2.0f >= (float)(written + 1)) return 0;
+		return (int)currentDelay - 1;
+	}
+	// fills out[] with what WriteSample() would produce for the next
+	// numSamples writes, needs CanReadBlock(numSamples). WriteBlock() with the
+	// same number of samples has to follow before the next read
+	void ReadBlock(float* outBuf, int numSamples)
+	{
+		if (numSamples <= 0) return;
+		int di = (int)currentDelay;
+		float f = 1.0f - (currentDelay - di);
+		int first = (pos - di - 2) & mask; // oldest tap of the first output
+		if (first + numSamples + 3 <= size)
+		{
+			const float* y = &dat[first];
+			VecN vf = VecN::Set(f);
+			int k = 0;
+			for (; k + VecN::Width <= numSamples; k += VecN::Width)
+				Hermite(VecN::LoadU(y + k), VecN::LoadU(y + k + 1), VecN::LoadU(y + k + 2), VecN::LoadU(y + k + 3), vf).StoreU(outBuf + k);
+			for (; k < numSamples; ++k)
+				outBuf[k] = Hermite(y[k], y[k + 1], y[k + 2], y[k + 3], f);
+		}
+		else
+		{
+			for (int k = 0; k < numSamples; ++k)
+				outBuf[k] = Hermite(dat[(first + k) & mask], dat[(first + k + 1) & mask], dat[(first + k + 2) & mask], dat[(first + k + 3) & mask], f);
+		}
+		out = outBuf[numSamples - 1];
+	}
+	void WriteBlock(const float* in, int numSamples)
+	{
+		int n1 = size - pos < numSamples ? size - pos : numSamples;
+		for (int k = 0; k < n1; ++k) dat[pos + k] = in[k];
+		for (int k = n1; k < numSamples; ++k) dat[k - n1] = in[k];
+		pos = (pos + numSamples) & mask;
+		written = written + numSamples < size ? written + numSamples : size;
 	}
+	// O(1): stale samples are masked by 'written' instead of clearing the buffer
 	void Reset()
 	{
-		std::fill(dat, dat + MaxDelayLen, 0.0f);
+		written = 0;
 		out = 0;
+		thiranZ = 0;
 	}
 };
\ No newline at end of file
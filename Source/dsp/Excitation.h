@@ -33,7 +33,8 @@ class ExcitationPiano
 private:
 	static std::vector<float> pcmData;
 	static bool isLoaded;
-	int readPosition = 0;
+	float readPosition = 0;
+	float readStep = 1.0f;
 	float currentVelocity = 0.0f;
 
 	void loadResource()
@@ -67,11 +68,19 @@ private:
 	}
 
 public:
+	// the impulse was voiced for playback at this rate, other rates resample it
+	constexpr static float DesignRate = 48000.0f;
+
 	ExcitationPiano()
 	{
 		loadResource();
 	}
 
+	void Prepare(float sampleRate)
+	{
+		readStep = DesignRate / sampleRate;
+	}
+
 	void NoteOn(float velocity)
 	{
 		currentVelocity = velocity;
@@ -82,14 +91,22 @@ public:
 	{
 	}
 
+	bool IsFinished() const
+	{
+		return readPosition >= pcmData.size();
+	}
+
 	inline float ProcessSample()
 	{
-		if (readPosition >= pcmData.size())
+		int i = (int)readPosition;
+		if (i >= (int)pcmData.size())
 			return 0.0f;
 
-		float output = pcmData[readPosition] * currentVelocity;
+		float f = readPosition - i;
+		float next = i + 1 < (int)pcmData.size() ? pcmData[i + 1] : 0.0f;
+		float output = (pcmData[i] + (next - pcmData[i]) * f) * currentVelocity;
 
-		readPosition++;
+		readPosition += readStep;
 
 		return output;
 	}
@@ -0,0 +1,118 @@
+#pragma once
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include "SimdVec.h"
+
+// atan and tanh approximations without libm calls, for Vec1 / Vec4 / Vec8
+// and plain floats, in three accuracy tiers. Every tier is branch free, the
+// scalar float overloads run the Vec1 instantiation.
+//
+// Max absolute error against std::atan / std::tanh (double reference, float
+// evaluation over [-1e4, 1e4] resp. [-20, 20]) and time per result relative to
+// atanf / tanhf, for the float overload and for VecN (x64 gcc -O3, SSE2,
+// "DspBench FastMath"; DspTests checks the error bounds):
+//
+//   tier     atan     float  VecN    tanh     float  VecN    form
+//   Low      1.4e-4   0.24   0.19    1.0e-3   0.17   0.04    degree 7 minimax / [5/4] Pade
+//   Medium   2.5e-6   0.27   0.22    5.2e-6   0.27   0.06    degree 11 minimax / [9/8] Pade
+//   High     1.4e-7   0.20   0.19    3.8e-7   0.22   0.06    cephes atanf / 13/6 minimax
+//
+// The atan polynomials are minimax on |x| <= 1 with the linear term fixed at
+// 1, so small signals pass with unity gain (the string saturator sits inside
+// the feedback loop, a slope error there changes the decay time). Larger
+// arguments go through atan(x) = pi/2 - atan(1/x). The tanh rationals clamp
+// their input where the approximation is closest to +-1.
+enum class MathTier
+{
+	Low,
+	Medium,
+	High
+};
+
+template<MathTier Tier = MathTier::High, typename V>
+inline V Atan(V x)
+{
+	V ax = V::Abs(x);
+	if constexpr (Tier == MathTier::High)
+	{
+		// cephes atanf: range reduction to |x| <= tan(pi/8) and a degree 9 odd polynomial
+		V big = V::Less(V::Set(2.414213562373095f), ax);
+		V mid = V::Less(V::Set(0.4142135623730950f), ax);
+		V num = V::Select(big, V::Set(-1.0f), V::Select(mid, ax - V::Set(1.0f), ax));
+		V den = V::Select(big, ax, V::Select(mid, ax + V::Set(1.0f), V::Set(1.0f)));
+		V y0 = V::Select(big, V::Set(1.5707963267948966f), V::Select(mid, V::Set(0.7853981633974483f), V::Zero()));
+		V r = num / den;
+		V z = r * r;
+		V p = V::Set(8.05374449538e-2f) * z - V::Set(1.38776856032e-1f);
+		p = p * z + V::Set(1.99777106478e-1f);
+		p = p * z - V::Set(3.33329491539e-1f);
+		V y = y0 + (p * z * r + r);
+		return V::CopySign(y, x);
+	}
+	V one = V::Set(1.0f);
+	V r = V::Min(ax, one) / V::Max(ax, one);
+	V z = r * r;
+	V p;
+	if constexpr (Tier == MathTier::Medium)
+	{
+		p = V::Set(-1.280840570e-2f) * z + V::Set(5.580624011e-2f);
+		p = p * z - V::Set(1.198189529e-1f);
+		p = p * z + V::Set(1.951828977e-1f);
+		p = p * z - V::Set(3.329659736e-1f);
+	}
+	else
+	{
+		p = V::Set(-4.381294812e-2f) * z + V::Set(1.553161995e-1f);
+		p = p * z - V::Set(3.262382106e-1f);
+	}
+	p = p * z * r + r;
+	V y = V::Select(V::Less(one, ax), V::Set(1.5707963267948966f) - p, p);
+	return V::CopySign(y, x);
+}
+
+template<MathTier Tier = MathTier::High, typename V>
+inline V Tanh(V x)
+{
+	if constexpr (Tier == MathTier::High)
+	{
+		// odd 13/6 minimax rational, exact to a few ulp inside the clamp
+		x = V::Min(V::Max(x, V::Set(-7.99881172180175781f)), V::Set(7.99881172180175781f));
+		V z = x * x;
+		V p = V::Set(-2.76076847742355e-16f) * z + V::Set(2.00018790482477e-13f);
+		p = p * z - V::Set(8.60467152213735e-11f);
+		p = p * z + V::Set(5.12229709037114e-08f);
+		p = p * z + V::Set(1.48572235717979e-05f);
+		p = p * z + V::Set(6.37261928875436e-04f);
+		p = p * z + V::Set(4.89352455891786e-03f);
+		V q = V::Set(1.19825839466702e-06f) * z + V::Set(1.18534705686654e-04f);
+		q = q * z + V::Set(2.26843463243900e-03f);
+		q = q * z + V::Set(4.89352518554385e-03f);
+		return x * p / q;
+	}
+	if constexpr (Tier == MathTier::Medium)
+	{
+		x = V::Min(V::Max(x, V::Set(-6.11f)), V::Set(6.11f));
+		V z = x * x;
+		V p = (((z + V::Set(990.0f)) * z + V::Set(135135.0f)) * z + V::Set(4729725.0f)) * z + V::Set(34459425.0f);
+		V q = (((V::Set(45.0f) * z + V::Set(13860.0f)) * z + V::Set(945945.0f)) * z + V::Set(16216200.0f)) * z + V::Set(34459425.0f);
+		return x * p / q;
+	}
+	x = V::Min(V::Max(x, V::Set(-3.46f)), V::Set(3.46f));
+	V z = x * x;
+	V p = (z + V::Set(105.0f)) * z + V::Set(945.0f);
+	V q = (V::Set(15.0f) * z + V::Set(420.0f)) * z + V::Set(945.0f);
+	return x * p / q;
+}
+
+template<MathTier Tier = MathTier::High>
+inline float Atan(float x)
+{
+	return Atan<Tier>(Vec1{ x }).v;
+}
+
+template<MathTier Tier = MathTier::High>
+inline float Tanh(float x)
+{
+	return Tanh<Tier>(Vec1{ x }).v;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "RigidStringWaveguide.h"
+
+// how the strings of a key are struck, tuned and heard. Three strings is the
+// original trichord: the hammer drives the middle string, the output is the
+// mean of the outer two. Its sound lives in the modes that leave the bridge
+// at rest, so a bichord is driven one string against the other on the same
+// bridge and a single string gets no bridge term. The output gains keep the
+// trichord level (+-20% over cross, unison and the bass range), the struck
+// string always gets the full hammer so the overdrive behaves the same.
+// Neighbouring strings keep the unison ratio.
+struct StringLayout
+{
+	constexpr static int MaxStrings = 3;
+	float drive[4];
+	float pickup[4];
+
+	static const StringLayout& Get(int strings)
+	{
+		alignas(16) static const StringLayout layouts[MaxStrings] = {
+			{ { 1.0f, 0, 0, 0 }, { 0.42f, 0, 0, 0 } },
+			{ { 1.0f, -0.5f, 0, 0 }, { 0, 0.56f, 0, 0 } },
+			{ { -0.25f, 1.0f, -0.25f, 0 }, { 0.5f, 0, 0.5f, 0 } },
+		};
+		return layouts[strings - 1];
+	}
+	// fundamentals of the strings of a key, freq is the note
+	static void Freqs(float freq, float unison, int strings, float* out)
+	{
+		float freqK = (1.0 - unison) + unison * (1.03);
+		if (strings == 3)
+		{
+			out[0] = freq;
+			out[1] = freq * freqK;
+			out[2] = freq / freqK;
+			return;
+		}
+		if (strings == 2)
+		{
+			float k = sqrtf(freqK);
+			out[0] = freq * k;
+			out[1] = freq / k;
+			return;
+		}
+		out[0] = freq;
+	}
+	static float BridgeStiffness(float cross, int strings)
+	{
+		if (strings == 1) return 0.0f;
+		return cross * 2.0 / 3.0;
+	}
+};
+
+// loop settings of the three strings of every key, so note on and note off
+// only copy coefficients. Only the loop delay depends on the key, the filter
+// coefficients are the same for every key and computed once per change.
+// A key is (re)computed the first time it is used after SetParams() or
+// Prepare() changed something its delays depend on (pitch, unison, disp,
+// damp_high, the rate, the oversampling factor), so a parameter change costs at most the old per-note
+// math for the keys that are actually played, and nothing afterwards.
+// The nlapf phase delay is compensated for its resting coefficient (0).
+// Keys below the SetStringSplits() notes get one or two strings.
+class KeyTable
+{
+public:
+	constexpr static int NumKeys = 128;
+	struct Key
+	{
+		float freq = 0; // fundamental of the note
+		int strings = 3; // StringLayout of the key
+		float delay[3] = { 2.0f, 2.0f, 2.0f }; // WaveguideCoeffs::delay of each string
+	};
+private:
+	Key keys[NumKeys];
+	unsigned stamp[NumKeys] = { 0 }; // generation keys[] was built for
+	unsigned generation = 1;
+
+	float sampleRate = 48000;
+	int oversampling = 1;
+	int bichordFrom = 0, trichordFrom = 0;
+	float pitch = -1, disp = -1, unison = -1, damp_base = -1, damp_high = -1;
+	WaveguideCoeffs filter; // key independent part, overdrive left at 0
+	float releaseDampBase = 0;
+
+	void Build(int note)
+	{
+		Key& k = keys[note];
+		k.freq = 440.0f * powf(2.0f, (float)(note - 69) / 12.0f) * pitch;
+		k.strings = note < bichordFrom ? 1 : note < trichordFrom ? 2 : 3;
+		float freqs[3];
+		StringLayout::Freqs(k.freq, unison, k.strings, freqs);
+		for (int s = 0; s < k.strings; ++s)
+			k.delay[s] = RigidStringWaveguide::ComputeDelay(sampleRate, freqs[s], filter.dispA, filter.dampHigh, 0.0f, oversampling);
+		// a voice keeps the string count of its note on, a voice with more
+		// strings than the key plays the last one on the extra strings
+		for (int s = k.strings; s < 3; ++s) k.delay[s] = k.delay[k.strings - 1];
+		stamp[note] = generation;
+	}
+public:
+	// call from Prepare(), keys are rebuilt on their next use
+	void Prepare(float sampleRate)
+	{
+		this->sampleRate = sampleRate;
+		++generation;
+	}
+	// RigidStringWaveguide::SetOversampling() factor of the strings
+	void SetOversampling(int factor)
+	{
+		if (factor == oversampling) return;
+		oversampling = factor;
+		++generation;
+	}
+	// keys below bichordFrom have one string, keys below trichordFrom two,
+	// the others three. 0, 0 gives every key three strings
+	void SetStringSplits(int bichordFrom, int trichordFrom)
+	{
+		if (bichordFrom == this->bichordFrom && trichordFrom == this->trichordFrom) return;
+		this->bichordFrom = bichordFrom;
+		this->trichordFrom = trichordFrom;
+		++generation;
+	}
+	// cheap when nothing changed, may be called every block
+	void SetParams(float pitch, float disp, float unison, float damp_base, float damp_high)
+	{
+		bool delays = pitch != this->pitch || unison != this->unison || disp != this->disp || damp_high != this->damp_high;
+		if (!delays && damp_base == this->damp_base) return;
+		this->pitch = pitch;
+		this->disp = disp;
+		this->unison = unison;
+		this->damp_base = damp_base;
+		this->damp_high = damp_high;
+
+		filter = RigidStringWaveguide::ComputeFilterCoeffs(disp, 0.0f, damp_base, damp_high);
+		float damp_release = damp_base * 5.0;
+		if (damp_release > 1.0) damp_release = 1.0;
+		releaseDampBase = RigidStringWaveguide::ComputeFilterCoeffs(disp, 0.0f, damp_release, damp_high).dampBase;
+		if (delays) ++generation;
+	}
+	const Key& Get(int note)
+	{
+		if (stamp[note] != generation) Build(note);
+		return keys[note];
+	}
+	// settings of string s of a key, released selects the note off damping
+	WaveguideCoeffs GetCoeffs(const Key& key, int s, bool released) const
+	{
+		WaveguideCoeffs c = filter;
+		c.delay = key.delay[s];
+		if (released) c.dampBase = releaseDampBase;
+		return c;
+	}
+};
@@ -1,33 +1,196 @@
 #pragma once
 
+#include <type_traits>
 #include "RigidStringFDTD.h"
 #include "RigidStringWaveguide.h"
 #include "Excitation.h"
+#include "VoiceActivity.h"
+#include "LMEpianoBank.h"
+#include "LMEpianoPacked.h"
+#include "VoiceWorkerPool.h"
+#include "Resampler.h"
+#include "VoiceAllocator.h"
+#include "KeyTable.h"
+#include "VoiceDispatch.h"
 
-class LMEpiano
+// one key: three strings coupled at the bridge. String is RigidStringWaveguide
+// or RigidStringFDTD, both take the bridge through SetBoundary() and
+// GetLeftBoundary(); the waveguide only calls (SetStringCoeffs(),
+// SetInterpolation(), ...) are instantiated for the waveguide voice only.
+// Keys with one or two strings (StringLayout) leave the others untouched.
+// The per-sample code is compiled for each string count and, for the
+// waveguide, each interpolation kernel; ProcessBlock() picks the variant of
+// the voice once per block (VoiceDispatch.h)
+template<typename String>
+class LMEpianoVoice
 {
 private:
-	RigidStringWaveguide str1{ 48000 };
-	RigidStringWaveguide str2{ 48000 };
-	RigidStringWaveguide str3{ 48000 };
-	float v1 = 0, v2 = 0, v3 = 0;
+	constexpr static bool IsWaveguide = std::is_same<String, RigidStringWaveguide>::value;
+	String str1{ 48000 };
+	String str2{ 48000 };
+	String str3{ 48000 };
+	float v[3] = { 0 };
+	int numStrings = 3;
+	Interpolation interpolation = Interpolation::Hermite;
 	ExcitationPiano exciter;
 	float bridge_stiffness = 0.35f;
+	VoiceActivity activity;
+	float gain = 1.0f;
+	float fadeStep = 0; // gain decrement per sample while fading out
+	float bridgeTarget = 0.35f, bridgeStep = 0; // RampStringCoeffs() ramp
+	int rampLeft = 0;
+
+	// calls f(strings, mode) with the string count and interpolation of the
+	// voice as std::integral_constant, the fdtd strings have no interpolation
+	template<typename F>
+	void Dispatch(F&& f)
+	{
+		DispatchStrings(numStrings, [&](auto count) {
+			if constexpr (IsWaveguide)
+				DispatchInterpolation(interpolation, [&](auto mode) { f(count, mode); });
+			else
+				f(count, std::integral_constant<Interpolation, Interpolation::Hermite>());
+		});
+	}
+	// StringLayout::BridgeStiffness(), the fdtd strings' bridge sum kept at
+	// most RigidStringFDTD::MaxBridgeGain
+	float BridgeStiffness(float cross) const
+	{
+		float k = StringLayout::BridgeStiffness(cross, numStrings);
+		if constexpr (!IsWaveguide) k = fminf(k, String::MaxBridgeGain / numStrings);
+		return k;
+	}
+	template<Interpolation Mode>
+	static inline float ProcessString(String& str, float in)
+	{
+		if constexpr (IsWaveguide) return str.template ProcessSample<Mode>(in);
+		else return str.ProcessSample(in);
+	}
+	template<int Strings, Interpolation Mode>
+	inline void Step()
+	{
+		float exc = exciter.ProcessSample();
+		if (rampLeft > 0)
+		{
+			if (--rampLeft == 0) bridge_stiffness = bridgeTarget;
+			else bridge_stiffness += bridgeStep;
+		}
+
+		const StringLayout& layout = StringLayout::Get(Strings);
+		String* str[3] = { &str1, &str2, &str3 };
+		float sum = 0;
+		for (int s = 0; s < Strings; ++s) sum += str[s]->GetLeftBoundary();
+		float v_bridge = sum * bridge_stiffness;
+		for (int s = 0; s < Strings; ++s) str[s]->SetBoundary(v_bridge, 0.0f);
+		for (int s = 0; s < Strings; ++s) v[s] = ProcessString<Mode>(*str[s], exc * layout.drive[s]);
+	}
+	template<int Strings, Interpolation Mode>
+	void RenderBlock(float* outl, float* outr, int numSamples)
+	{
+		const StringLayout& layout = StringLayout::Get(Strings);
+		float peak = 0;
+		for (int n = 0; n < numSamples; ++n)
+		{
+			Step<Strings, Mode>();
+			float out = (v[0] * layout.pickup[0] + v[1] * layout.pickup[1] + v[2] * layout.pickup[2]) * gain;
+			outl[n] = out;
+			outr[n] = out;
+			peak = fmaxf(peak, fmaxf(fabsf(v[0]), fmaxf(fabsf(v[1]), fabsf(v[2]))));
+			if (fadeStep > 0) gain = fmaxf(gain - fadeStep, 0.0f);
+		}
+		activity.Update(peak, exciter.IsFinished(), numSamples);
+		if (fadeStep > 0 && gain <= 0)
+		{
+			activity.Sleep();
+			fadeStep = 0;
+		}
+	}
 public:
-	LMEpiano(float sampleRate = 48000.0f)
+	void Prepare(float sampleRate, float lowestFreq)
 	{
+		if constexpr (IsWaveguide)
+		{
+			str1.Prepare(sampleRate, lowestFreq);
+			str2.Prepare(sampleRate, lowestFreq);
+			str3.Prepare(sampleRate, lowestFreq);
+		}
+		else
+		{
+			str1.Prepare(sampleRate);
+			str2.Prepare(sampleRate);
+			str3.Prepare(sampleRate);
+		}
+		exciter.Prepare(sampleRate);
+		v[0] = v[1] = v[2] = 0;
 	}
 	void SetStringParams(float freq, float disp, float nlv, float cross, float unison, float damp_base, float damp_high)
 	{
-		str1.SetParams(freq, disp, nlv, damp_base, damp_high);
-		float freqK = (1.0 - unison) + unison * (1.03);
-		str2.SetParams(freq * freqK, disp, nlv, damp_base, damp_high);
-		str3.SetParams(freq / freqK, disp, nlv, damp_base, damp_high);
-		bridge_stiffness = cross * 2.0 / 3.0;
+		float freqs[3];
+		StringLayout::Freqs(freq, unison, numStrings, freqs);
+		String* str[3] = { &str1, &str2, &str3 };
+		for (int s = 0; s < numStrings; ++s)
+			str[s]->SetParams(freqs[s], disp, nlv, damp_base, damp_high);
+		bridge_stiffness = BridgeStiffness(cross);
+		rampLeft = 0;
+	}
+	// c[0..2] are the settings of the three strings, see KeyTable
+	void SetStringCoeffs(const WaveguideCoeffs* c, float cross)
+	{
+		String* str[3] = { &str1, &str2, &str3 };
+		for (int s = 0; s < numStrings; ++s) str[s]->SetCoeffs(c[s]);
+		bridge_stiffness = BridgeStiffness(cross);
+		rampLeft = 0;
+	}
+	// moves a sounding voice to new settings, the coefficients ramp linearly
+	// over numSamples
+	void RampStringCoeffs(const WaveguideCoeffs* c, float cross, int numSamples)
+	{
+		String* str[3] = { &str1, &str2, &str3 };
+		for (int s = 0; s < numStrings; ++s) str[s]->RampCoeffs(c[s], numSamples);
+		bridgeTarget = BridgeStiffness(cross);
+		if (numSamples <= 1)
+		{
+			bridge_stiffness = bridgeTarget;
+			rampLeft = 0;
+			return;
+		}
+		bridgeStep = (bridgeTarget - bridge_stiffness) / numSamples;
+		rampLeft = numSamples;
+	}
+	void SetInterpolation(Interpolation mode)
+	{
+		interpolation = mode;
+		str1.SetInterpolation(mode);
+		str2.SetInterpolation(mode);
+		str3.SetInterpolation(mode);
+	}
+	void SetOversampling(int factor)
+	{
+		str1.SetOversampling(factor);
+		str2.SetOversampling(factor);
+		str3.SetOversampling(factor);
+	}
+	// 1, 2 or 3 strings (StringLayout), call after Reset() before the
+	// coefficients of a new note
+	void SetStringCount(int n)
+	{
+		numStrings = n;
 	}
 	void NoteOn(float velocity)
 	{
 		exciter.NoteOn(velocity);
+		activity.Wake();
+		gain = 1.0f;
+		fadeStep = 0;
+	}
+	// fades the voice out linearly over numSamples, then puts it to sleep
+	void Fade(int numSamples)
+	{
+		fadeStep = 1.0f / (numSamples > 0 ? numSamples : 1);
+	}
+	float GetLevel() const
+	{
+		return activity.GetLevel();
 	}
 	void NoteOff()
 	{
@@ -35,50 +198,412 @@ public:
 	}
 	inline float ProcessSample()
 	{
-		float exc = exciter.ProcessSample();
-
-		float v_bridge = (v1 + v2 + v3) * bridge_stiffness;
-		float in1 = -v_bridge + v1 - exc * 0.25;
-		float in2 = -v_bridge + v2 + exc;
-		float in3 = -v_bridge + v3 - exc * 0.25;
-		v1 = str1.ProcessSample(in1);
-		v2 = str2.ProcessSample(in2);
-		v3 = str3.ProcessSample(in3);
+		Dispatch([&](auto count, auto mode) { Step<decltype(count)::value, decltype(mode)::value>(); });
 		return 0;
 	}
+	bool IsActive() const
+	{
+		return activity.IsActive();
+	}
 	void ProcessBlock(float* outl, float* outr, int numSamples)
 	{
-		for (int n = 0; n < numSamples; ++n)
-		{
-			ProcessSample();
-			outl[n] = (v1 + v3) * 0.5;
-			outr[n] = (v1 + v3) * 0.5;
-		}
+		Dispatch([&](auto count, auto mode) { RenderBlock<decltype(count)::value, decltype(mode)::value>(outl, outr, numSamples); });
 	}
 	void Reset()
 	{
 		str1.Reset();
 		str2.Reset();
 		str3.Reset();
+		v[0] = v[1] = v[2] = 0;
 	}
 };
 
-#define MaxNumPolys 16
+using LMEpiano = LMEpianoVoice<RigidStringWaveguide>;
+using LMEpianoFDTD = LMEpianoVoice<RigidStringFDTD>;
+
+#define MaxNumPolys 128
+#define DefaultNumPolys 16
+
+// plain copy of the plugin parameters, see LMEpianoPoly::SetParams()
+struct LMEpianoParams
+{
+	float pitch = 1.0f; // frequency multiplier
+	float disp = 0, nlv = 0, cross = 0.35f, unison = 0.5f, damp_base = 0.25f, damp_high = 0.25f;
+	int poly = DefaultNumPolys;
+	int quality = 1; // LMEpianoPoly::QualityStandard
+	int oversampling = 1; // 1, 2 or 4
+	int engine = 0; // LMEpianoPoly::EngineWaveguide, applied at Prepare(), see NeedsPrepare()
+	int threads = 0; // render threads besides the audio thread, applied at Prepare()
+	float internalRate = 0; // engine rate for faster hosts, 0 for the host rate, applied at Prepare()
+	int strings = 0; // LMEpianoPoly::StringsTrichords
+};
 class LMEpianoPoly
 {
 private:
-	LMEpiano polys[MaxNumPolys];
-	int notes[MaxNumPolys] = { 0 };
+	//up to 'polyphony' notes sound at once, the spare voices let stolen notes
+	//fade out while the new note already plays. The pool always holds
+	//NumVoices voices so changing the polyphony never allocates
+	constexpr static int StealVoices = 2;
+	constexpr static int NumVoices = MaxNumPolys + StealVoices;
+	constexpr static float StealFadeTime = 0.003f; // seconds
+	//packed voices: the three strings of a voice share one simd pass
+	//(LMEpianoPacked). packedOwner holds the voice of each one (-1 when free),
+	//packedSlot the packed voice of each voice (-1 for bank and fdtd voices)
+	std::vector<LMEpianoPacked> polys;
+	std::vector<int> packedOwner;
+	int packedSlot[NumVoices];
+	//finite difference voices, used instead of polys[] and the bank when the
+	//fdtd engine is selected
+	std::vector<LMEpianoFDTD> fdtdPolys;
+	int engine = EngineWaveguide;
+	bool useFdtd = false;
+	VoiceAllocator allocator;
+	int polyphony = DefaultNumPolys;
+	int stealFadeSamples = 144;
 
-	float tmpl[2048];
-	float tmpr[2048];
+	//the bank renders many voices per simd pass, but a group costs the same
+	//with one voice as with W. A packed voice costs 0.3-0.45 of a group (SSE2
+	//and AVX, 1x to 4x oversampling), so in VoicesAuto a new note takes a
+	//packed voice while at most PackedVoices sound. The note that makes more
+	//sound moves the packed ones into their bank lanes (TakeVoice()), the
+	//strings continue sample for sample and the chord renders in one group
+	constexpr static int PackedVoices = 2;
+	LMEpianoBank bank;
+	int voiceMode = VoicesAuto;
+	int preparedVoiceMode = VoicesAuto;
 
-	int pos = 0;
-	float pitch, disp, nlv, cross, unison, damp_base, damp_high;
+	//host blocks of any size are rendered in chunks of renderQuantum samples,
+	//chosen in Prepare(), so the scratch and task buffers stay small
+	constexpr static int MinRenderQuantum = 32;
+	constexpr static int MaxRenderQuantum = 256;
+	int renderQuantum = MaxRenderQuantum;
+	std::vector<float> tmpl, tmpr;
 
+	//optional multi-threaded rendering: every active voice (or bank group) is
+	//one task rendered into its own buffer, the buffers are mixed in task order
+	//so the result is bit-identical to rendering on the audio thread
+	constexpr static int MinThreadedBlock = 64;
+	VoiceWorkerPool workers;
+	int numWorkers = 0;
+	std::vector<float> taskBuf;
+	int tasks[NumVoices];
+	int numTasks = 0;
+	int numGroupTasks = 0; // tasks[] starts with the bank groups
+	int taskSamples = 0;
+
+	//optional fixed engine rate: the voices run at internalRate and are
+	//resampled to the host rate, so high host rates don't multiply the cost
+	float internalRate = 0;
+	float hostRate = 48000;
+	float engineRate = 48000;
+	bool resample = false;
+	Resampler resampler;
+
+	float pitch = 1, disp = 0, nlv = 0, cross = 0, unison = 0, damp_base = 0, damp_high = 0;
+	//loop settings per key, rebuilt when the parameters they depend on change
+	KeyTable keyTable;
+	//parameter changes reach the sounding voices at the start of the next
+	//rendered block, their coefficients ramp over ControlRamp samples
+	constexpr static int ControlRamp = 32;
+	bool paramsChanged = false;
+
+	//delay line interpolation per register (bass, mid, treble) for each
+	//quality setting, standard is the original hermite everywhere
+	constexpr static float BassSplit = 220.0f;
+	constexpr static float TrebleSplit = 880.0f;
+	int quality = QualityStandard;
+	//rate factor of the string saturators, see SetOversampling()
+	int oversampling = 1;
+	//StringsPiano: single strings up to E1, bichords up to B2 (MIDI notes)
+	constexpr static int PianoBichordFrom = 29;
+	constexpr static int PianoTrichordFrom = 48;
+	int stringLayout = StringsTrichords;
+	static Interpolation GetInterpolation(int quality, float freq)
+	{
+		static const Interpolation table[3][3] = {
+			{ Interpolation::Linear, Interpolation::Linear, Interpolation::Hermite },
+			{ Interpolation::Hermite, Interpolation::Hermite, Interpolation::Hermite },
+			{ Interpolation::Hermite, Interpolation::Thiran, Interpolation::Sinc },
+		};
+		int reg = freq < BassSplit ? 0 : freq < TrebleSplit ? 1 : 2;
+		return table[quality][reg];
+	}
+
+	void GetVoiceCoeffs(WaveguideCoeffs* c, const KeyTable::Key& key, bool released)
+	{
+		for (int s = 0; s < 3; ++s)
+		{
+			c[s] = keyTable.GetCoeffs(key, s, released);
+			c[s].overdrive = nlv;
+		}
+	}
+	void SetVoiceParams(int i, int note, bool released)
+	{
+		const KeyTable::Key& key = keyTable.Get(note);
+		if (useFdtd)
+		{
+			float damp = released ? fminf(damp_base * 5.0f, 1.0f) : damp_base;
+			fdtdPolys[i].SetStringParams(key.freq, disp, nlv, cross, unison, damp, damp_high);
+			return;
+		}
+		WaveguideCoeffs c[3];
+		GetVoiceCoeffs(c, key, released);
+		Interpolation mode = GetInterpolation(quality, key.freq);
+		if (packedSlot[i] < 0)
+		{
+			bank.SetInterpolation(i, mode);
+			bank.SetStringCoeffs(i, c, cross);
+		}
+		else
+		{
+			polys[packedSlot[i]].SetInterpolation(mode);
+			polys[packedSlot[i]].SetStringCoeffs(c, cross);
+		}
+	}
+	//moves every sounding voice to the current parameters. The interpolation
+	//mode stays, switching it on a ringing string would click
+	void UpdateVoices()
+	{
+		for (int a = 0; a < allocator.GetNumActive(); ++a)
+		{
+			int i = allocator.GetActive(a);
+			int note = allocator.GetNote(i);
+			if (note < 0) continue; // stolen, fading out
+			if (useFdtd)
+			{
+				SetVoiceParams(i, note, !allocator.IsHeld(i));
+				continue;
+			}
+			WaveguideCoeffs c[3];
+			GetVoiceCoeffs(c, keyTable.Get(note), !allocator.IsHeld(i));
+			if (packedSlot[i] < 0) bank.RampStringCoeffs(i, c, cross, ControlRamp);
+			else polys[packedSlot[i]].RampStringCoeffs(c, cross, ControlRamp);
+		}
+		paramsChanged = false;
+	}
+	float GetVoiceLevel(int v) const
+	{
+		return useFdtd ? fdtdPolys[v].GetLevel() : packedSlot[v] >= 0 ? polys[packedSlot[v]].GetLevel() : bank.GetLevel(v);
+	}
+	bool IsVoiceActive(int v) const
+	{
+		return useFdtd ? fdtdPolys[v].IsActive() : packedSlot[v] >= 0 ? polys[packedSlot[v]].IsActive() : bank.IsActive(v);
+	}
+	void FadeVoice(int v)
+	{
+		if (useFdtd) fdtdPolys[v].Fade(stealFadeSamples);
+		else if (packedSlot[v] >= 0) polys[packedSlot[v]].Fade(stealFadeSamples);
+		else bank.Fade(v, stealFadeSamples);
+	}
+	//puts the new note of waveguide voice v on a free packed voice or the bank
+	void AssignVoice(int v)
+	{
+		FreeVoice(v);
+		if (preparedVoiceMode == VoicesAuto && allocator.GetNumActive() > PackedVoices)
+		{
+			for (int s = 0; s < (int)polys.size(); ++s)
+			{
+				int owner = packedOwner[s];
+				if (owner < 0) continue;
+				bank.TakeVoice(owner, polys[s]);
+				FreeVoice(owner);
+			}
+			return;
+		}
+		for (int s = 0; s < (int)polys.size(); ++s)
+		{
+			if (packedOwner[s] >= 0) continue;
+			packedOwner[s] = v;
+			packedSlot[v] = s;
+			return;
+		}
+	}
+	void FreeVoice(int v)
+	{
+		if (packedSlot[v] >= 0) packedOwner[packedSlot[v]] = -1;
+		packedSlot[v] = -1;
+	}
+	static void RenderTask(void* ctx, int t)
+	{
+		LMEpianoPoly& p = *(LMEpianoPoly*)ctx;
+		float* l = &p.taskBuf[(size_t)t * 2 * p.renderQuantum];
+		float* r = l + p.renderQuantum;
+		if (t < p.numGroupTasks)
+		{
+			for (int i = 0; i < p.taskSamples; ++i) l[i] = r[i] = 0;
+			p.bank.ProcessGroup(p.tasks[t], l, r, p.taskSamples);
+		}
+		else if (p.useFdtd)
+		{
+			p.fdtdPolys[p.tasks[t]].ProcessBlock(l, r, p.taskSamples);
+		}
+		else
+		{
+			p.polys[p.tasks[t]].ProcessBlock(l, r, p.taskSamples);
+		}
+	}
 public:
+	enum { QualityEco, QualityStandard, QualityHigh };
+	enum { EngineWaveguide, EngineFDTD };
+	enum { StringsTrichords, StringsPiano };
+	enum { VoicesAuto, VoicesBank, VoicesPacked };
+
+	// range of the pitch parameter in semitones, LMEpianoParams::pitch is
+	// 2^(semitones / 12)
+	constexpr static float MinPitch = -48.0f;
+	constexpr static float MaxPitch = 48.0f;
+	// lowest string fundamental the delay lines are sized for: MIDI note 0 at
+	// MinPitch, 440 * 2^((0 - 69 - 48) / 12) = 0.511 Hz, and the lowest string
+	// of its trichord at full unison (1 / 1.03 below). Every note of the
+	// parameter range keeps its pitch
+	constexpr static float LowestFreq = 0.496f;
+	// most worker threads SetRenderThreads() starts
+	constexpr static int MaxRenderThreads = 8;
+
+	LMEpianoPoly()
+	{
+		Prepare(48000);
+	}
+	// waveguide voice rendering: VoicesAuto (packed voices while at most
+	// PackedVoices notes sound, all of them move to the bank above), VoicesBank (many voices per
+	// simd pass) or VoicesPacked (the strings of one voice per simd pass).
+	// Takes effect at the next Prepare()
+	void SetVoiceMode(int mode)
+	{
+		voiceMode = mode == VoicesBank || mode == VoicesPacked ? mode : VoicesAuto;
+	}
+	// sounding notes on packed voices
+	int GetNumPackedVoices() const
+	{
+		int n = 0;
+		for (int v : packedOwner) n += v >= 0;
+		return n;
+	}
+	// chunked string processing of the bank (LMEpianoBank::SetChunked()), on
+	// by default. Same output either way
+	void SetChunked(bool enable)
+	{
+		bank.SetChunked(enable);
+	}
+	// specialised group loops of the bank (LMEpianoBank::SetSpecialised()),
+	// on by default. Same output either way
+	void SetSpecialised(bool enable)
+	{
+		bank.SetSpecialised(enable);
+	}
+	// string model, EngineWaveguide or EngineFDTD (finite differences, more
+	// CPU). Takes effect at the next Prepare(), which allocates its voices
+	void SetEngine(int e)
+	{
+		engine = e == EngineFDTD ? EngineFDTD : EngineWaveguide;
+	}
+	// true when a setting that only takes effect at Prepare() changed since
+	// the last one, the plugin then prepares again outside the audio callback
+	bool NeedsPrepare() const
+	{
+		float rate = internalRate > 0 && internalRate < hostRate ? internalRate : hostRate;
+		return (engine == EngineFDTD) != useFdtd || numWorkers != workers.GetNumWorkers() || rate != engineRate || voiceMode != preparedVoiceMode;
+	}
+	// number of worker threads besides the audio thread, 0 renders everything
+	// in the audio callback. Takes effect at the next Prepare()
+	void SetRenderThreads(int num)
+	{
+		numWorkers = num < 0 ? 0 : num > MaxRenderThreads ? MaxRenderThreads : num;
+	}
+	// QualityEco / QualityStandard / QualityHigh, used from the next note on
+	void SetQuality(int q)
+	{
+		quality = q < QualityEco ? QualityEco : q > QualityHigh ? QualityHigh : q;
+	}
+	// runs the nonlinear stage of every string (nlapf and saturator) at 1x, 2x
+	// or 4x the engine rate against aliasing of its harmonics. Takes effect at
+	// once, sounding strings are retuned and their nonlinear stage restarts
+	void SetOversampling(int factor)
+	{
+		factor = factor >= 4 ? 4 : factor >= 2 ? 2 : 1;
+		if (factor == oversampling) return;
+		oversampling = factor;
+		keyTable.SetOversampling(factor);
+		bank.SetOversampling(factor);
+		for (auto& v : polys) v.SetOversampling(factor);
+		paramsChanged = true;
+	}
+	// StringsTrichords (three strings on every key) or StringsPiano (single
+	// strings in the bass, bichords in the tenor). Used from the next note on,
+	// sounding voices keep their strings. Mostly a timbre setting: every voice
+	// keeps the memory of three strings (any voice can take any key), packed
+	// voices run their strings in one fixed width pass and a bank group runs
+	// the strings of its most strung voice. Only the fdtd voices and bank
+	// groups of bass notes alone run fewer (DspBench StringLayout)
+	void SetStringLayout(int layout)
+	{
+		stringLayout = layout == StringsPiano ? StringsPiano : StringsTrichords;
+		if (stringLayout == StringsPiano) keyTable.SetStringSplits(PianoBichordFrom, PianoTrichordFrom);
+		else keyTable.SetStringSplits(0, 0);
+	}
+	// number of notes that sound at once, 1..MaxNumPolys. Safe to call from
+	// the audio thread, voices above a lowered limit fade out
+	void SetPolyphony(int num)
+	{
+		num = num < 1 ? 1 : num > MaxNumPolys ? MaxNumPolys : num;
+		if (num == polyphony) return;
+		polyphony = num;
+		allocator.SetPolyphony(num);
+		int victim;
+		while ((victim = allocator.StealExcess([this](int v) { return GetVoiceLevel(v); })) >= 0)
+			FadeVoice(victim);
+	}
+	// engine rate used when the host runs faster, 0 always renders at the
+	// host rate. Takes effect at the next Prepare()
+	void SetInternalRate(float rate)
+	{
+		internalRate = rate;
+	}
+	// sizes every dsp object for the host rate and block size, call from
+	// prepareToPlay
+	void Prepare(float sampleRate, int maxBlockSize = 2048)
+	{
+		hostRate = sampleRate;
+		engineRate = internalRate > 0 && internalRate < sampleRate ? internalRate : sampleRate;
+		resample = engineRate != sampleRate;
+		renderQuantum = maxBlockSize < MinRenderQuantum ? MinRenderQuantum : maxBlockSize > MaxRenderQuantum ? MaxRenderQuantum : maxBlockSize;
+		tmpl.assign(renderQuantum, 0.0f);
+		tmpr.assign(renderQuantum, 0.0f);
+		if (resample) resampler.Prepare(engineRate, sampleRate, renderQuantum);
+
+		workers.Start(numWorkers, maxBlockSize, engineRate);
+		taskBuf.assign((size_t)NumVoices * 2 * renderQuantum, 0.0f);
+		stealFadeSamples = (int)(StealFadeTime * engineRate);
+		keyTable.Prepare(engineRate);
+
+		//only the engine in use holds voice memory
+		useFdtd = engine == EngineFDTD;
+		preparedVoiceMode = voiceMode;
+		allocator.Prepare(NumVoices, polyphony);
+		bank.Prepare(useFdtd || voiceMode == VoicesPacked ? 0 : NumVoices, engineRate, LowestFreq);
+		polys.resize(useFdtd || voiceMode == VoicesBank ? 0 : voiceMode == VoicesPacked ? NumVoices : PackedVoices);
+		for (auto& v : polys)
+			v.Prepare(engineRate, LowestFreq);
+		packedOwner.assign(polys.size(), -1);
+		for (int& s : packedSlot) s = -1;
+		fdtdPolys.resize(useFdtd ? NumVoices : 0);
+		for (auto& v : fdtdPolys)
+			v.Prepare(engineRate, LowestFreq);
+		bank.SetOversampling(oversampling);
+		for (auto& v : polys)
+			v.SetOversampling(oversampling);
+	}
+	// output delay of the resampler in host samples
+	int GetLatencySamples() const
+	{
+		if (!resample) return 0;
+		return (int)lroundf(resampler.GetLatencyInputSamples() * hostRate / engineRate);
+	}
 	void SetStringParams(float pitch, float disp, float nlv, float cross, float unison, float damp_base, float damp_high)
 	{
+		if (pitch != this->pitch || disp != this->disp || nlv != this->nlv || cross != this->cross
+			|| unison != this->unison || damp_base != this->damp_base || damp_high != this->damp_high)
+			paramsChanged = true;
 		this->pitch = pitch;
 		this->disp = disp;
 		this->nlv = nlv;
@@ -86,58 +611,171 @@ public:
 		this->unison = unison;
 		this->damp_base = damp_base;
 		this->damp_high = damp_high;
+		keyTable.SetParams(pitch, disp, unison, damp_base, damp_high);
+	}
+	// everything the plugin exposes in one call, cheap when nothing changed
+	void SetParams(const LMEpianoParams& p)
+	{
+		SetStringParams(p.pitch, p.disp, p.nlv, p.cross, p.unison, p.damp_base, p.damp_high);
+		SetPolyphony(p.poly);
+		SetQuality(p.quality);
+		SetOversampling(p.oversampling);
+		SetEngine(p.engine);
+		SetRenderThreads(p.threads);
+		SetInternalRate(p.internalRate);
+		SetStringLayout(p.strings);
 	}
+	// note is the MIDI note number, 69 plays 440 Hz times the pitch
 	void NoteOn(int note, float velo)
 	{
-		for (int i = 0; i < MaxNumPolys; ++i)
+		if (note < 0 || note > 127) return;
+		int i = allocator.FindVoice(note);
+		if (i >= 0)
+		{
+			//strike the ringing string again
+			allocator.Strike(i);
+			SetVoiceParams(i, note, false);
+			if (useFdtd) fdtdPolys[i].NoteOn(velo);
+			else if (packedSlot[i] >= 0) polys[packedSlot[i]].NoteOn(velo);
+			else bank.NoteOn(i, velo);
+			return;
+		}
+		int victim;
+		i = allocator.Allocate(note, [this](int v) { return GetVoiceLevel(v); }, victim);
+		if (victim >= 0) FadeVoice(victim);
+		int strings = keyTable.Get(note).strings;
+		if (useFdtd)
 		{
-			if (notes[i] == note)
+			fdtdPolys[i].Reset();
+			fdtdPolys[i].SetStringCount(strings);
+		}
+		else
+		{
+			AssignVoice(i);
+			if (packedSlot[i] >= 0)
 			{
-				float freq = 440.0 * powf(2.0f, (float)(note - 69) / 12.0f);
-				polys[i].SetStringParams(freq * pitch, disp, nlv, cross, unison, damp_base, damp_high);
-				polys[i].NoteOn(velo);
-				return;
+				polys[packedSlot[i]].Reset();
+				polys[packedSlot[i]].SetStringCount(strings);
+			}
+			else
+			{
+				bank.Reset(i);
+				bank.SetStringCount(i, strings);
 			}
 		}
-		polys[pos].Reset();
-		float freq = 440.0 * powf(2.0f, (float)(note - 69) / 12.0f);
-		polys[pos].SetStringParams(freq * pitch, disp, nlv, cross, unison, damp_base, damp_high);
-		polys[pos].NoteOn(velo);
-		notes[pos] = note;
-		pos++;
-		if (pos >= MaxNumPolys)pos = 0;
+		SetVoiceParams(i, note, false);
+		if (useFdtd) fdtdPolys[i].NoteOn(velo);
+		else if (packedSlot[i] >= 0) polys[packedSlot[i]].NoteOn(velo);
+		else bank.NoteOn(i, velo);
 	}
 	void NoteOff(int note)
 	{
-		for (int i = 0; i < MaxNumPolys; ++i)
+		if (note < 0 || note > 127) return;
+		int i = allocator.FindVoice(note);
+		if (i < 0) return;
+		SetVoiceParams(i, note, true);
+		if (useFdtd) fdtdPolys[i].NoteOff();
+		else if (packedSlot[i] >= 0) polys[packedSlot[i]].NoteOff();
+		else bank.NoteOff(i);
+		allocator.Release(i);
+	}
+	void Release()
+	{
+		workers.Stop();
+	}
+	void ProcessBlock(float* outl, float* outr, int numSamples)
+	{
+		for (int done = 0; done < numSamples;)
 		{
-			if (notes[i] == note)
+			int n = numSamples - done < renderQuantum ? numSamples - done : renderQuantum;
+			if (!resample)
+			{
+				RenderBlock(outl + done, outr + done, n);
+				done += n;
+				continue;
+			}
+			int need = resampler.GetInputNeeded(n);
+			while (need > 0)
 			{
-				float freq = 440.0 * powf(2.0f, (float)(note - 69) / 12.0f);
-				float damp_release = damp_base * 5.0;
-				if (damp_release > 1.0)damp_release = 1.0;
-				polys[i].SetStringParams(freq * pitch, disp, nlv, cross, unison, damp_release, damp_high);
-				polys[i].NoteOff();
-				notes[pos] = -1;
-				return;
+				int m = need < renderQuantum ? need : renderQuantum;
+				RenderBlock(resampler.GetInputL(), resampler.GetInputR(), m);
+				resampler.CommitInput(m);
+				need -= m;
 			}
+			resampler.Process(outl + done, outr + done, n);
+			done += n;
 		}
 	}
-	void ProcessBlock(float* outl, float* outr, int numSamples)
+private:
+	// renders numSamples (<= renderQuantum) at the engine rate
+	void RenderBlock(float* outl, float* outr, int numSamples)
 	{
+		if (paramsChanged) UpdateVoices();
 		for (int i = 0; i < numSamples; ++i)
 		{
 			outl[i] = 0;
 			outr[i] = 0;
 		}
-		for (int j = 0; j < MaxNumPolys; ++j)
+
+		//only voices in the allocator's active list are rendered: the bank
+		//groups holding one first, then the packed (or fdtd) voices
+		numTasks = 0;
+		if (!useFdtd)
+		{
+			bool groupActive[NumVoices] = { false };
+			for (int a = 0; a < allocator.GetNumActive(); ++a)
+				if (packedSlot[allocator.GetActive(a)] < 0) groupActive[allocator.GetActive(a) / LMEpianoBank::W] = true;
+			for (int g = 0; g < bank.GetNumGroups(); ++g)
+				if (groupActive[g]) tasks[numTasks++] = g;
+		}
+		numGroupTasks = numTasks;
+		for (int a = 0; a < allocator.GetNumActive(); ++a)
+		{
+			int v = allocator.GetActive(a);
+			if (useFdtd) tasks[numTasks++] = v;
+			else if (packedSlot[v] >= 0) tasks[numTasks++] = packedSlot[v];
+		}
+		if (workers.GetNumWorkers() > 0 && numSamples >= MinThreadedBlock && numTasks > 1)
+		{
+			taskSamples = numSamples;
+			workers.Run(numTasks, &LMEpianoPoly::RenderTask, this);
+			for (int t = 0; t < numTasks; ++t)
+			{
+				const float* l = &taskBuf[(size_t)t * 2 * renderQuantum];
+				const float* r = l + renderQuantum;
+				for (int i = 0; i < numSamples; ++i)
+				{
+					outl[i] += l[i];
+					outr[i] += r[i];
+				}
+			}
+		}
+		else
 		{
-			polys[j].ProcessBlock(tmpl, tmpr, numSamples);
-			for (int i = 0; i < numSamples; ++i)
+			for (int t = 0; t < numTasks; ++t)
 			{
-				outl[i] += tmpl[i];
-				outr[i] += tmpr[i];
+				if (t < numGroupTasks)
+				{
+					bank.ProcessGroup(tasks[t], outl, outr, numSamples);
+					continue;
+				}
+				if (useFdtd) fdtdPolys[tasks[t]].ProcessBlock(tmpl.data(), tmpr.data(), numSamples);
+				else polys[tasks[t]].ProcessBlock(tmpl.data(), tmpr.data(), numSamples);
+				for (int i = 0; i < numSamples; ++i)
+				{
+					outl[i] += tmpl[i];
+					outr[i] += tmpr[i];
+				}
 			}
 		}
+
+		//voices that went to sleep leave the active list
+		for (int a = allocator.GetNumActive() - 1; a >= 0; --a)
+		{
+			int v = allocator.GetActive(a);
+			if (IsVoiceActive(v)) continue;
+			if (!useFdtd) FreeVoice(v);
+			allocator.Retire(v);
+		}
 	}
 };
\ No newline at end of file
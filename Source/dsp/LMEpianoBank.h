@@ -0,0 +1,877 @@
+#pragma once
+
+#include <vector>
+#include "SimdVec.h"
+#include "FastMath.h"
+#include "RigidStringWaveguide.h"
+#include "Excitation.h"
+#include "VoiceActivity.h"
+#include "KeyTable.h"
+#include "VoiceDispatch.h"
+
+// V::Width RigidStringWaveguide loops advanced together, one string per lane.
+// The lanes share the write position and the delay buffer is interleaved as
+// [sample][lane], so a single vector store writes the input of every lane.
+// Each lane follows the scalar RigidStringWaveguide operation for operation,
+// except that the delay taps are gathered per lane and Atan() runs on V
+// (same RigidStringWaveguide::AtanTier). Every lane has its own DelayLine
+// interpolation mode, the modes not used by any lane cost nothing.
+// LMEpianoBank runs VecN with one voice per lane, LMEpianoPacked Vec4 with
+// the strings of one voice.
+template<typename V>
+class WaveguideLanes
+{
+public:
+	constexpr static int W = V::Width;
+	// longest ReadChunk()
+	constexpr static int MaxChunk = 64;
+private:
+	std::vector<float> dat;
+	int size = 0;
+	int mask = 0;
+	int pos = 0;
+
+	// lane resets are O(1) like DelayLine::Reset(): taps written before the
+	// lane's last reset read as 0
+	long long clock = 0;
+	long long resetClock[W] = { 0 };
+	long long lastReset = 0;
+
+	float sampleRate = 48000;
+	float delayVelocity = 1.0 / (float)DelayLine::GradientSamples;
+
+	alignas(32) float currentDelay[W] = { 0 };
+	alignas(32) float targetDelay[W] = { 0 };
+	alignas(32) float dispA[W] = { 0 };
+	alignas(32) float dampHigh[W] = { 0 };
+	LoopFilter<V> loop;
+	alignas(32) float nlA[W] = { 0 };
+	alignas(32) float nlZ0[W] = { 0 };
+	alignas(32) float nlZ1[W] = { 0 };
+	alignas(32) float overdrive[W] = { 0 };
+	alignas(32) float thiranZ[W] = { 0 };
+	Interpolation interp[W];
+	bool anyLinear = false, anyThiran = false, anySinc = false;
+	alignas(32) float isLinear[W] = { 0 };
+	alignas(32) float isThiran[W] = { 0 };
+	Oversampler<V> oversampler; // same factor for every lane
+	int lanes = W; // SetLanes()
+	bool tuned[W] = { false }; // SetCoeffs() since Prepare()
+	template<typename> friend class WaveguideLanes;
+
+	// linear coefficient ramps of RampCoeffs(), one per lane. dampIn holds
+	// WaveguideCoeffs::dampBase, the loop filter gets its complement
+	struct Ramp
+	{
+		alignas(32) float step[W] = { 0 };
+		alignas(32) float target[W] = { 0 };
+	};
+	Ramp dispRamp, dampRamp, highRamp, driveRamp;
+	alignas(32) float dampIn[W] = { 0 };
+	alignas(32) float rampLeft[W] = { 0 };
+	int rampSamples = 0; // samples until the longest ramp ends
+
+	static inline void StepRamp(float* cur, const Ramp& r, V done)
+	{
+		V::Select(done, V::Load(r.target), V::Load(cur) + V::Load(r.step)).Store(cur);
+	}
+	inline void StepRamps()
+	{
+		// a lane takes its target on the last step, idle lanes sit at it
+		V left = V::Load(rampLeft) - V::Set(1.0f);
+		V done = V::Less(left, V::Set(0.5f));
+		V::Max(left, V::Zero()).Store(rampLeft);
+		StepRamp(dispA, dispRamp, done);
+		StepRamp(dampIn, dampRamp, done);
+		StepRamp(dampHigh, highRamp, done);
+		StepRamp(overdrive, driveRamp, done);
+		loop.SetCoeffs(V::Load(dispA), V::Set(1.0f) - V::Load(dampIn), V::Load(dampHigh));
+		rampSamples--;
+	}
+	static inline void StartRamp(Ramp& r, int lane, float cur, float target, int numSamples)
+	{
+		r.target[lane] = target;
+		r.step[lane] = (target - cur) / numSamples;
+	}
+
+	static inline V Allpass(V x, V a, float* z)
+	{
+		V zv = V::Load(z);
+		V out = -a * x + zv;
+		(x + a * out).Store(z);
+		return out;
+	}
+	// RigidStringWaveguide::SaturateOversampled() on every lane
+	inline V SaturateOversampled(V x)
+	{
+		V a = Atan<RigidStringWaveguide::AtanTier>(x * x * x * V::Set(8.0f)) * V::Set(2.0f / M_PI) * V::Load(overdrive);
+		a.Store(nlA);
+		a = RigidStringWaveguide::NlapfAtRate(a, V::Set((float)oversampler.GetFactor()));
+		x = Allpass(x, a, nlZ0);
+		x = Allpass(x, a, nlZ1);
+		return Atan<RigidStringWaveguide::AtanTier>(x * V::Set(0.2f)) * V::Set(5.0f);
+	}
+	inline float LaneTap(int l, int age, long long written) const
+	{
+		if (age >= written) return 0.0f;
+		return dat[(size_t)((pos - age) & mask) * W + l];
+	}
+	// currentDelay after one more sample of the glide
+	inline V NextDelay() const
+	{
+		V cur = V::Load(currentDelay);
+		return cur + V::Set(delayVelocity) * (V::Load(targetDelay) - cur);
+	}
+	// ramps, input write and delay glide of one sample
+	inline void Advance(V in)
+	{
+		if (rampSamples > 0) StepRamps();
+		in.StoreU(&dat[(size_t)pos * W]);
+		clock++;
+		NextDelay().Store(currentDelay);
+	}
+	static inline V Hermite(V v0, V v1, V v2, V v3, V f)
+	{
+		V c0 = v1;
+		V c1 = V::Set(0.5f) * (v2 - v0);
+		V c2 = v0 - V::Set(2.5f) * v1 + V::Set(2.0f) * v2 - V::Set(0.5f) * v3;
+		V c3 = V::Set(0.5f) * (v3 - v0) + V::Set(1.5f) * (v1 - v2);
+		return ((c3 * f + c2) * f + c1) * f + c0;
+	}
+	// loop filter, nlapf and saturator on the interpolated delay output
+	inline V ProcessLoop(V x)
+	{
+		x = loop.Process(x);
+		if (oversampler.GetFactor() > 1)
+			return oversampler.Process(x, [this](V x) { return SaturateOversampled(x); });
+
+		V a = Atan<RigidStringWaveguide::AtanTier>(x * x * x * V::Set(8.0f)) * V::Set(2.0f / M_PI) * V::Load(overdrive);
+		a.Store(nlA);
+		x = Allpass(x, a, nlZ0);
+		x = Allpass(x, a, nlZ1);
+
+		return Atan<RigidStringWaveguide::AtanTier>(x * V::Set(0.2f)) * V::Set(5.0f);
+	}
+public:
+	WaveguideLanes()
+	{
+		for (int l = 0; l < W; ++l) interp[l] = Interpolation::Hermite;
+	}
+	void Prepare(float sampleRate, float lowestFreq)
+	{
+		this->sampleRate = sampleRate;
+		int maxDelay = (int)ceilf(sampleRate / lowestFreq) + 1;
+		int n = 4;
+		while (n < maxDelay + DelayLine::Headroom) n <<= 1;
+		size = n;
+		mask = n - 1;
+		dat.assign((size_t)n * W, 0.0f);
+		pos = 0;
+		clock = 0;
+		lastReset = 0;
+		for (int l = 0; l < W; ++l)
+		{
+			resetClock[l] = 0;
+			tuned[l] = false;
+			if (targetDelay[l] > size - DelayLine::Headroom) targetDelay[l] = size - DelayLine::Headroom;
+			if (currentDelay[l] > size - DelayLine::Headroom) currentDelay[l] = size - DelayLine::Headroom;
+			Reset(l);
+		}
+	}
+	void SetParams(int lane, float freq, float disp, float overdrive, float damp_base, float damp_high)
+	{
+		SetCoeffs(lane, RigidStringWaveguide::ComputeCoeffs(sampleRate, freq, disp, overdrive, damp_base, damp_high, nlA[lane], oversampler.GetFactor()));
+	}
+	// RigidStringWaveguide::SetOversampling() for all lanes
+	void SetOversampling(int factor)
+	{
+		if (factor == oversampler.GetFactor()) return;
+		oversampler.SetFactor(factor);
+		for (int l = 0; l < W; ++l) nlA[l] = nlZ0[l] = nlZ1[l] = 0;
+	}
+	void SetCoeffs(int lane, const WaveguideCoeffs& c)
+	{
+		targetDelay[lane] = c.delay < size - DelayLine::Headroom ? c.delay : size - DelayLine::Headroom;
+		dispA[lane] = dispRamp.target[lane] = c.dispA;
+		dampIn[lane] = dampRamp.target[lane] = c.dampBase;
+		dampHigh[lane] = highRamp.target[lane] = c.dampHigh;
+		loop.SetCoeffs(lane, c.dispA, 1.0 - c.dampBase, c.dampHigh);
+		this->overdrive[lane] = driveRamp.target[lane] = c.overdrive;
+		rampLeft[lane] = 0;
+		tuned[lane] = true;
+	}
+	// same as RigidStringWaveguide::RampCoeffs()
+	void RampCoeffs(int lane, const WaveguideCoeffs& c, int numSamples)
+	{
+		if (numSamples <= 1)
+		{
+			SetCoeffs(lane, c);
+			return;
+		}
+		targetDelay[lane] = c.delay < size - DelayLine::Headroom ? c.delay : size - DelayLine::Headroom;
+		StartRamp(dispRamp, lane, dispA[lane], c.dispA, numSamples);
+		StartRamp(dampRamp, lane, dampIn[lane], c.dampBase, numSamples);
+		StartRamp(highRamp, lane, dampHigh[lane], c.dampHigh, numSamples);
+		StartRamp(driveRamp, lane, overdrive[lane], c.overdrive, numSamples);
+		rampLeft[lane] = (float)numSamples;
+		if (rampSamples < numSamples) rampSamples = numSamples;
+		tuned[lane] = true;
+	}
+	void SetInterpolation(int lane, Interpolation mode)
+	{
+		if (mode == interp[lane]) return;
+		interp[lane] = mode;
+		thiranZ[lane] = 0;
+		isLinear[lane] = mode == Interpolation::Linear;
+		isThiran[lane] = mode == Interpolation::Thiran;
+		anyLinear = anyThiran = anySinc = false;
+		for (int l = 0; l < W; ++l)
+		{
+			anyLinear |= interp[l] == Interpolation::Linear;
+			anyThiran |= interp[l] == Interpolation::Thiran;
+			anySinc |= interp[l] == Interpolation::Sinc;
+		}
+	}
+	// only lanes 0..n-1 read their delay line, the others output 0 (they
+	// must be Reset() and get no input)
+	void SetLanes(int n)
+	{
+		lanes = n < 1 ? 1 : n > W ? W : n;
+	}
+	// lane takes over the string of lane 'from' of lanes of any width,
+	// prepared for the same rate and oversampling: delay line, coefficients,
+	// ramps and filter states. It continues sample for sample. Only the last
+	// twice the delay (plus the interpolation taps) are copied, older samples
+	// read as zero like after Reset(): the lines are sized for the lowest
+	// pitch the parameters reach and a whole one costs milliseconds. A delay
+	// that later grows past that reads zeros instead of the old samples until
+	// the line has been written that far again
+	template<typename U>
+	void CopyLane(int lane, const WaveguideLanes<U>& src, int from)
+	{
+		float delay = src.currentDelay[from] > src.targetDelay[from] ? src.currentDelay[from] : src.targetDelay[from];
+		long long keep = src.clock - src.resetClock[from];
+		long long reach = 2 * (long long)ceilf(delay) + DelayLine::Headroom;
+		if (keep > reach) keep = reach;
+		if (keep > size) keep = size;
+		for (int k = 0; k < keep; ++k)
+			dat[(size_t)((pos - k) & mask) * W + lane] = src.dat[(size_t)((src.pos - k) & src.mask) * U::Width + from];
+		resetClock[lane] = clock - keep;
+		if (lastReset < resetClock[lane]) lastReset = resetClock[lane];
+
+		SetInterpolation(lane, src.interp[from]);
+		currentDelay[lane] = src.currentDelay[from];
+		targetDelay[lane] = src.targetDelay[from];
+		dispA[lane] = src.dispA[from];
+		dampIn[lane] = src.dampIn[from];
+		dampHigh[lane] = src.dampHigh[from];
+		overdrive[lane] = src.overdrive[from];
+		loop.CopyLane(lane, src.loop, from);
+		nlA[lane] = src.nlA[from];
+		nlZ0[lane] = src.nlZ0[from];
+		nlZ1[lane] = src.nlZ1[from];
+		thiranZ[lane] = src.thiranZ[from];
+		oversampler.CopyLane(lane, src.oversampler, from);
+
+		Ramp* ramps[] = { &dispRamp, &dampRamp, &highRamp, &driveRamp };
+		const typename WaveguideLanes<U>::Ramp* srcRamps[] = { &src.dispRamp, &src.dampRamp, &src.highRamp, &src.driveRamp };
+		for (int r = 0; r < 4; ++r)
+		{
+			ramps[r]->step[lane] = srcRamps[r]->step[from];
+			ramps[r]->target[lane] = srcRamps[r]->target[from];
+		}
+		rampLeft[lane] = src.rampLeft[from];
+		if (rampSamples < (int)rampLeft[lane]) rampSamples = (int)rampLeft[lane];
+		tuned[lane] = src.tuned[from];
+	}
+	void Reset(int lane)
+	{
+		resetClock[lane] = clock;
+		lastReset = clock;
+		loop.Reset(lane);
+		nlZ0[lane] = nlZ1[lane] = 0;
+		thiranZ[lane] = 0;
+		oversampler.Reset(lane);
+	}
+	inline V ProcessSample(V in)
+	{
+		Advance(in);
+
+		// thiran lanes put their two taps in y1/y2 and their allpass delay in
+		// fr, sinc lanes are finished here
+		alignas(32) float y0[W], y1[W], y2[W], y3[W], fr[W], sinc[W], useSinc[W];
+		bool allFresh = clock - lastReset >= size;
+		for (int l = lanes; l < W; ++l)
+		{
+			y0[l] = y1[l] = y2[l] = y3[l] = 0;
+			fr[l] = sinc[l] = useSinc[l] = 0;
+		}
+		for (int l = 0; l < lanes; ++l)
+		{
+			long long written = allFresh ? size : clock - resetClock[l];
+			if (interp[l] == Interpolation::Thiran)
+			{
+				int m = (int)(currentDelay[l] - 0.5f);
+				fr[l] = currentDelay[l] - m;
+				y1[l] = LaneTap(l, m, written);
+				y2[l] = LaneTap(l, m + 1, written);
+				y0[l] = y3[l] = 0;
+				sinc[l] = useSinc[l] = 0;
+				continue;
+			}
+			int di = (int)currentDelay[l];
+			fr[l] = 1.0f - (currentDelay[l] - di);
+			if (interp[l] == Interpolation::Sinc && di >= SincTable::Taps / 2 - 1)
+			{
+				alignas(32) float y[SincTable::Taps];
+				for (int j = 0; j < SincTable::Taps; ++j) y[j] = LaneTap(l, di + SincTable::Taps / 2 - j, written);
+				sinc[l] = SincTable::Dot(y, SincTable::Row(currentDelay[l] - di));
+				useSinc[l] = 1.0f;
+			}
+			else
+			{
+				sinc[l] = 0;
+				useSinc[l] = 0;
+			}
+			y0[l] = LaneTap(l, di + 2, written);
+			y1[l] = LaneTap(l, di + 1, written);
+			y2[l] = LaneTap(l, di, written);
+			y3[l] = LaneTap(l, di - 1, written);
+		}
+		pos = (pos + 1) & mask;
+
+		V v0 = V::Load(y0), v1 = V::Load(y1), v2 = V::Load(y2), v3 = V::Load(y3);
+		V f = V::Load(fr);
+		V x = Hermite(v0, v1, v2, v3, f);
+		if (anyLinear)
+		{
+			V lin = v1 * (V::Set(1.0f) - f) + v2 * f;
+			x = V::Select(V::Less(V::Zero(), V::Load(isLinear)), lin, x);
+		}
+		if (anyThiran)
+		{
+			V isTh = V::Less(V::Zero(), V::Load(isThiran));
+			V ta = (V::Set(1.0f) - f) / (V::Set(1.0f) + f);
+			V tz = V::Select(isTh, ta * (v1 - V::Load(thiranZ)) + v2, V::Zero());
+			tz.Store(thiranZ);
+			x = V::Select(isTh, tz, x);
+		}
+		if (anySinc)
+		{
+			// lanes with a delay too short for the sinc keep the hermite value
+			x = V::Select(V::Less(V::Zero(), V::Load(useSinc)), V::Load(sinc), x);
+		}
+		return ProcessLoop(x);
+	}
+	// ProcessSample() with SetLanes(Lanes) and every used lane interpolating
+	// with Mode, both known at compile time: the tap gather unrolls and only
+	// the one kernel runs. Same output as ProcessSample()
+	template<int Lanes, Interpolation Mode>
+	inline V ProcessSample(V in)
+	{
+		Advance(in);
+
+		alignas(32) float y0[W], y1[W], y2[W], y3[W], fr[W], sinc[W], useSinc[W];
+		bool allFresh = clock - lastReset >= size;
+		for (int l = Lanes; l < W; ++l)
+		{
+			y0[l] = y1[l] = y2[l] = y3[l] = 0;
+			fr[l] = sinc[l] = useSinc[l] = 0;
+		}
+		for (int l = 0; l < Lanes; ++l)
+		{
+			long long written = allFresh ? size : clock - resetClock[l];
+			if constexpr (Mode == Interpolation::Thiran)
+			{
+				int m = (int)(currentDelay[l] - 0.5f);
+				fr[l] = currentDelay[l] - m;
+				y1[l] = LaneTap(l, m, written);
+				y2[l] = LaneTap(l, m + 1, written);
+				continue;
+			}
+			int di = (int)currentDelay[l];
+			fr[l] = 1.0f - (currentDelay[l] - di);
+			if constexpr (Mode == Interpolation::Sinc)
+			{
+				sinc[l] = useSinc[l] = 0;
+				if (di >= SincTable::Taps / 2 - 1)
+				{
+					alignas(32) float y[SincTable::Taps];
+					for (int j = 0; j < SincTable::Taps; ++j) y[j] = LaneTap(l, di + SincTable::Taps / 2 - j, written);
+					sinc[l] = SincTable::Dot(y, SincTable::Row(currentDelay[l] - di));
+					useSinc[l] = 1.0f;
+				}
+			}
+			if constexpr (Mode != Interpolation::Linear)
+			{
+				y0[l] = LaneTap(l, di + 2, written);
+				y3[l] = LaneTap(l, di - 1, written);
+			}
+			y1[l] = LaneTap(l, di + 1, written);
+			y2[l] = LaneTap(l, di, written);
+		}
+		pos = (pos + 1) & mask;
+
+		V v1 = V::Load(y1), v2 = V::Load(y2);
+		V f = V::Load(fr);
+		V x;
+		if constexpr (Mode == Interpolation::Linear)
+		{
+			x = v1 * (V::Set(1.0f) - f) + v2 * f;
+		}
+		else if constexpr (Mode == Interpolation::Thiran)
+		{
+			V ta = (V::Set(1.0f) - f) / (V::Set(1.0f) + f);
+			x = ta * (v1 - V::Load(thiranZ)) + v2;
+			x.Store(thiranZ);
+		}
+		else
+		{
+			x = Hermite(V::Load(y0), v1, v2, V::Load(y3), f);
+			if constexpr (Mode == Interpolation::Sinc)
+				x = V::Select(V::Less(V::Zero(), V::Load(useSinc)), V::Load(sinc), x);
+		}
+		return ProcessLoop(x);
+	}
+	// chunked processing: the outputs of a run shorter than every lane's
+	// delay don't read its inputs, so ReadChunk() returns them before
+	// WriteChunk() takes the inputs and the taps skip the per-sample delay
+	// update. Longest run possible now, 0 while a ramp runs or a delay
+	// glides, when a lane isn't Hermite or a tap still falls before a lane's
+	// Reset(). Lanes without coefficients since Prepare() don't count, they
+	// must get no input (their delay line only holds zeros, any tap reads 0)
+	int GetChunkLimit() const
+	{
+		if (rampSamples > 0 || anyLinear || anyThiran || anySinc) return 0;
+		alignas(32) float next[W];
+		NextDelay().Store(next);
+		int n = MaxChunk;
+		for (int l = 0; l < lanes; ++l)
+		{
+			if (!tuned[l]) continue;
+			if (next[l] != currentDelay[l]) return 0;
+			int di = (int)currentDelay[l];
+			if (di + 2 >= clock + 1 - resetClock[l]) return 0;
+			if (di - 1 < n) n = di - 1;
+		}
+		return n;
+	}
+	// the next n <= GetChunkLimit() outputs, same as n ProcessSample() calls
+	void ReadChunk(V* out, int n)
+	{
+		alignas(32) float y0[W] = { 0 }, y1[W] = { 0 }, y2[W] = { 0 }, y3[W] = { 0 }, fr[W] = { 0 };
+		int di[W];
+		for (int l = 0; l < lanes; ++l)
+		{
+			di[l] = (int)currentDelay[l];
+			fr[l] = 1.0f - (currentDelay[l] - di[l]);
+		}
+		V f = V::Load(fr);
+		for (int k = 0; k < n; ++k)
+		{
+			for (int l = 0; l < lanes; ++l)
+			{
+				int p = pos + k - di[l];
+				y0[l] = dat[(size_t)((p - 2) & mask) * W + l];
+				y1[l] = dat[(size_t)((p - 1) & mask) * W + l];
+				y2[l] = dat[(size_t)(p & mask) * W + l];
+				y3[l] = dat[(size_t)((p + 1) & mask) * W + l];
+			}
+			out[k] = ProcessLoop(Hermite(V::Load(y0), V::Load(y1), V::Load(y2), V::Load(y3), f));
+		}
+	}
+	// inputs of the run ReadChunk() returned
+	void WriteChunk(const V* in, int n)
+	{
+		for (int k = 0; k < n; ++k) in[k].StoreU(&dat[(size_t)((pos + k) & mask) * W]);
+		pos = (pos + n) & mask;
+		clock += n;
+	}
+};
+
+// LMEpiano voices rendered VecN::Width at a time: lane l of group g is voice
+// g * W + l. Groups without an active voice are skipped, str2 / str3 of a
+// group only run while one of its active voices has that many strings.
+// Settled groups run their strings in chunks (SetChunked()), 15% less CPU
+// than sample by sample with held notes. The group loop is compiled per
+// string count and, when all lanes of the group share it, interpolation
+// (SetSpecialised(), VoiceDispatch.h): a quarter off the linear string step,
+// 14% off sinc, hermite and thiran gain nothing measurable.
+// Tolerance against the scalar LMEpiano (16 voices, 4 s, peak ~1.2):
+//   nlv = 0    max sample error 1.2e-6
+//   nlv = 0.3  max sample error 5.4e-5
+//   nlv = 0.7  the string model is chaotic at strong overdrive, the scalar path
+//              diverges the same way from itself when only FMA contraction is
+//              switched on; rms level matches within 0.1%.
+class LMEpianoBank
+{
+public:
+	constexpr static int W = VecN::Width;
+private:
+	struct Group
+	{
+		WaveguideLanes<VecN> str1, str2, str3;
+		alignas(32) float v1[W] = { 0 };
+		alignas(32) float v2[W] = { 0 };
+		alignas(32) float v3[W] = { 0 };
+		alignas(32) float bridge_stiffness[W] = { 0 };
+		alignas(32) float bridgeTarget[W] = { 0 }; // RampStringCoeffs() ramp
+		alignas(32) float bridgeStep[W] = { 0 };
+		alignas(32) float rampLeft[W] = { 0 };
+		int rampSamples = 0;
+		alignas(32) float gain[W] = { 0 }; // 1 for active lanes, 0 for sleeping ones
+		alignas(32) float fadeStep[W] = { 0 }; // gain decrement per sample while fading out
+		// StringLayout of each lane: hammer drive and output gain per string,
+		// and 1 where the string exists (it takes the bridge)
+		alignas(32) float drive[3][W] = { { 0 } };
+		alignas(32) float pickup[3][W] = { { 0 } };
+		alignas(32) float feed[3][W] = { { 0 } };
+		int strings[W] = { 0 };
+		Interpolation interp[W]; // of each lane, see SetInterpolation()
+		Group()
+		{
+			for (auto& mode : interp) mode = Interpolation::Hermite;
+		}
+	};
+	static void SetLayout(Group& g, int l, int strings)
+	{
+		const StringLayout& layout = StringLayout::Get(strings);
+		for (int s = 0; s < 3; ++s)
+		{
+			g.drive[s][l] = layout.drive[s];
+			g.pickup[s][l] = layout.pickup[s];
+			g.feed[s][l] = s < strings ? 1.0f : 0.0f;
+		}
+		g.strings[l] = strings;
+	}
+	std::vector<Group> groups;
+	std::vector<ExcitationPiano> exciters;
+	std::vector<VoiceActivity> activity;
+	int numVoices = 0;
+
+	// strings run in chunks (WaveguideLanes::ReadChunk()) of MinChunk to
+	// MaxChunk samples where every string of the group allows it, sample by
+	// sample elsewhere. Same output either way
+	constexpr static int MinChunk = 4;
+	constexpr static int MaxChunk = WaveguideLanes<VecN>::MaxChunk;
+	bool chunked = true;
+	int GetChunkLength(const Group& g, int strings, int rest) const
+	{
+		if (!chunked || g.rampSamples > 0) return 0;
+		int len = rest < MaxChunk ? rest : MaxChunk;
+		const WaveguideLanes<VecN>* str[3] = { &g.str1, &g.str2, &g.str3 };
+		for (int s = 0; s < strings; ++s)
+		{
+			int m = str[s]->GetChunkLimit();
+			if (m < len) len = m;
+		}
+		return len >= MinChunk ? len : 0;
+	}
+	bool specialised = true;
+	template<Interpolation Mode, bool Uniform>
+	static inline VecN ProcessString(WaveguideLanes<VecN>& str, VecN in)
+	{
+		if constexpr (Uniform) return str.template ProcessSample<W, Mode>(in);
+		else return str.ProcessSample(in);
+	}
+	// ProcessGroup() with the string count of the group and, when every lane
+	// interpolates the same way (Uniform), the interpolation as constants
+	template<int Strings, Interpolation Mode, bool Uniform>
+	void RenderGroup(int gi, float* outl, float* outr, int numSamples)
+	{
+		Group& g = groups[gi];
+		int first = gi * W;
+		int count = numVoices - first < W ? numVoices - first : W;
+
+		VecN v1 = VecN::Load(g.v1), v2 = VecN::Load(g.v2), v3 = VecN::Load(g.v3);
+		VecN d1 = VecN::Load(g.drive[0]), d2 = VecN::Load(g.drive[1]), d3 = VecN::Load(g.drive[2]);
+		VecN p1 = VecN::Load(g.pickup[0]), p2 = VecN::Load(g.pickup[1]), p3 = VecN::Load(g.pickup[2]);
+		VecN f2 = VecN::Load(g.feed[1]), f3 = VecN::Load(g.feed[2]);
+		VecN stiffness = VecN::Load(g.bridge_stiffness);
+		VecN gain = VecN::Load(g.gain);
+		VecN fadeStep = VecN::Load(g.fadeStep);
+		VecN peak = VecN::Zero();
+		alignas(32) float excs[W] = { 0 };
+		auto mix = [&](int n) {
+			float out = ((v1 * p1 + v2 * p2 + v3 * p3) * gain).Sum();
+			gain = VecN::Max(gain - fadeStep, VecN::Zero());
+			outl[n] += out;
+			outr[n] += out;
+			peak = VecN::Max(peak, VecN::Max(VecN::Abs(v1), VecN::Max(VecN::Abs(v2), VecN::Abs(v3))));
+		};
+		for (int n = 0; n < numSamples;)
+		{
+			int len = GetChunkLength(g, Strings, numSamples - n);
+			if (len > 0)
+			{
+				// string outputs of the whole run first, then the inputs from
+				// the outputs of the sample before, as in the per-sample loop
+				VecN exc[MaxChunk], o1[MaxChunk], o2[MaxChunk], o3[MaxChunk], in1[MaxChunk], in2[MaxChunk], in3[MaxChunk];
+				for (int k = 0; k < len; ++k)
+				{
+					for (int l = 0; l < count; ++l)
+						excs[l] = exciters[first + l].ProcessSample();
+					exc[k] = VecN::Load(excs);
+				}
+				g.str1.ReadChunk(o1, len);
+				if constexpr (Strings >= 2) g.str2.ReadChunk(o2, len);
+				if constexpr (Strings >= 3) g.str3.ReadChunk(o3, len);
+				for (int k = 0; k < len; ++k, ++n)
+				{
+					VecN v_bridge = (v1 + v2 + v3) * stiffness;
+					in1[k] = v1 - v_bridge + exc[k] * d1;
+					in2[k] = v2 - v_bridge * f2 + exc[k] * d2;
+					in3[k] = v3 - v_bridge * f3 + exc[k] * d3;
+					v1 = o1[k];
+					if constexpr (Strings >= 2) v2 = o2[k];
+					if constexpr (Strings >= 3) v3 = o3[k];
+					mix(n);
+				}
+				g.str1.WriteChunk(in1, len);
+				if constexpr (Strings >= 2) g.str2.WriteChunk(in2, len);
+				if constexpr (Strings >= 3) g.str3.WriteChunk(in3, len);
+				continue;
+			}
+
+			for (int l = 0; l < count; ++l)
+				excs[l] = exciters[first + l].ProcessSample();
+			VecN exc = VecN::Load(excs);
+			if (g.rampSamples > 0)
+			{
+				VecN left = VecN::Load(g.rampLeft) - VecN::Set(1.0f);
+				stiffness = VecN::Select(VecN::Less(left, VecN::Set(0.5f)), VecN::Load(g.bridgeTarget), stiffness + VecN::Load(g.bridgeStep));
+				VecN::Max(left, VecN::Zero()).Store(g.rampLeft);
+				g.rampSamples--;
+			}
+
+			// strings a lane doesn't have stay at 0: no bridge, no hammer
+			VecN v_bridge = (v1 + v2 + v3) * stiffness;
+			v1 = ProcessString<Mode, Uniform>(g.str1, v1 - v_bridge + exc * d1);
+			if constexpr (Strings >= 2) v2 = ProcessString<Mode, Uniform>(g.str2, v2 - v_bridge * f2 + exc * d2);
+			if constexpr (Strings >= 3) v3 = ProcessString<Mode, Uniform>(g.str3, v3 - v_bridge * f3 + exc * d3);
+			mix(n++);
+		}
+		v1.Store(g.v1);
+		v2.Store(g.v2);
+		v3.Store(g.v3);
+		stiffness.Store(g.bridge_stiffness);
+		gain.Store(g.gain);
+
+		alignas(32) float peaks[W];
+		peak.Store(peaks);
+		for (int l = 0; l < count; ++l)
+		{
+			int i = first + l;
+			if (!activity[i].IsActive()) continue;
+			activity[i].Update(peaks[l], exciters[i].IsFinished(), numSamples);
+			if (g.fadeStep[l] > 0 && g.gain[l] <= 0)
+			{
+				activity[i].Sleep();
+				g.fadeStep[l] = 0;
+			}
+			if (!activity[i].IsActive()) g.gain[l] = 0.0f;
+		}
+	}
+public:
+	// chunked string processing on (default) or off, for comparisons
+	void SetChunked(bool enable)
+	{
+		chunked = enable;
+	}
+	// per-sample loops compiled per string count and interpolation (default)
+	// or the generic loop, for comparisons. Same output either way
+	void SetSpecialised(bool enable)
+	{
+		specialised = enable;
+	}
+	void Prepare(int numVoices, float sampleRate, float lowestFreq)
+	{
+		this->numVoices = numVoices;
+		groups.resize((numVoices + W - 1) / W);
+		for (auto& g : groups)
+		{
+			g.str1.Prepare(sampleRate, lowestFreq);
+			g.str2.Prepare(sampleRate, lowestFreq);
+			g.str3.Prepare(sampleRate, lowestFreq);
+			for (int l = 0; l < W; ++l)
+			{
+				g.v1[l] = g.v2[l] = g.v3[l] = g.gain[l] = g.fadeStep[l] = 0;
+				SetLayout(g, l, 3);
+			}
+		}
+		exciters.resize(numVoices);
+		for (auto& e : exciters) e.Prepare(sampleRate);
+		activity.assign(numVoices, VoiceActivity());
+	}
+	void SetStringParams(int voice, float freq, float disp, float nlv, float cross, float unison, float damp_base, float damp_high)
+	{
+		Group& g = groups[voice / W];
+		int l = voice % W;
+		float freqs[3];
+		StringLayout::Freqs(freq, unison, g.strings[l], freqs);
+		WaveguideLanes<VecN>* str[3] = { &g.str1, &g.str2, &g.str3 };
+		for (int s = 0; s < g.strings[l]; ++s)
+			str[s]->SetParams(l, freqs[s], disp, nlv, damp_base, damp_high);
+		g.bridge_stiffness[l] = g.bridgeTarget[l] = StringLayout::BridgeStiffness(cross, g.strings[l]);
+		g.rampLeft[l] = 0;
+	}
+	// c[0..2] are the settings of the three strings, see KeyTable
+	void SetStringCoeffs(int voice, const WaveguideCoeffs* c, float cross)
+	{
+		Group& g = groups[voice / W];
+		int l = voice % W;
+		WaveguideLanes<VecN>* str[3] = { &g.str1, &g.str2, &g.str3 };
+		for (int s = 0; s < g.strings[l]; ++s) str[s]->SetCoeffs(l, c[s]);
+		g.bridge_stiffness[l] = g.bridgeTarget[l] = StringLayout::BridgeStiffness(cross, g.strings[l]);
+		g.rampLeft[l] = 0;
+	}
+	// moves a sounding voice to new settings, the coefficients ramp linearly
+	// over numSamples
+	void RampStringCoeffs(int voice, const WaveguideCoeffs* c, float cross, int numSamples)
+	{
+		Group& g = groups[voice / W];
+		int l = voice % W;
+		WaveguideLanes<VecN>* str[3] = { &g.str1, &g.str2, &g.str3 };
+		for (int s = 0; s < g.strings[l]; ++s) str[s]->RampCoeffs(l, c[s], numSamples);
+		g.bridgeTarget[l] = StringLayout::BridgeStiffness(cross, g.strings[l]);
+		if (numSamples <= 1)
+		{
+			g.bridge_stiffness[l] = g.bridgeTarget[l];
+			g.rampLeft[l] = 0;
+			return;
+		}
+		g.bridgeStep[l] = (g.bridgeTarget[l] - g.bridge_stiffness[l]) / numSamples;
+		g.rampLeft[l] = (float)numSamples;
+		if (g.rampSamples < numSamples) g.rampSamples = numSamples;
+	}
+	void SetOversampling(int factor)
+	{
+		for (auto& g : groups)
+		{
+			g.str1.SetOversampling(factor);
+			g.str2.SetOversampling(factor);
+			g.str3.SetOversampling(factor);
+		}
+	}
+	void SetInterpolation(int voice, Interpolation mode)
+	{
+		Group& g = groups[voice / W];
+		int l = voice % W;
+		g.str1.SetInterpolation(l, mode);
+		g.str2.SetInterpolation(l, mode);
+		g.str3.SetInterpolation(l, mode);
+		g.interp[l] = mode;
+	}
+	// 1, 2 or 3 strings (StringLayout), call after Reset() before the
+	// coefficients of a new note
+	void SetStringCount(int voice, int strings)
+	{
+		SetLayout(groups[voice / W], voice % W, strings);
+	}
+	void NoteOn(int voice, float velocity)
+	{
+		exciters[voice].NoteOn(velocity);
+		activity[voice].Wake();
+		groups[voice / W].gain[voice % W] = 1.0f;
+		groups[voice / W].fadeStep[voice % W] = 0;
+	}
+	// fades the voice out linearly over numSamples, then puts it to sleep
+	void Fade(int voice, int numSamples)
+	{
+		groups[voice / W].fadeStep[voice % W] = 1.0f / (numSamples > 0 ? numSamples : 1);
+	}
+	float GetLevel(int voice) const
+	{
+		return activity[voice].GetLevel();
+	}
+	void NoteOff(int voice)
+	{
+		exciters[voice].NoteOff();
+	}
+	bool IsActive(int voice) const
+	{
+		return activity[voice].IsActive();
+	}
+	void Reset(int voice)
+	{
+		Group& g = groups[voice / W];
+		int l = voice % W;
+		g.str1.Reset(l);
+		g.str2.Reset(l);
+		g.str3.Reset(l);
+		g.v1[l] = g.v2[l] = g.v3[l] = 0;
+	}
+	// voice continues the sounding LMEpianoPacked p sample for sample, p
+	// must be prepared for the same rate and oversampling
+	template<typename Packed>
+	void TakeVoice(int voice, const Packed& p)
+	{
+		Group& g = groups[voice / W];
+		int l = voice % W;
+		SetLayout(g, l, p.numStrings);
+		WaveguideLanes<VecN>* str[] = { &g.str1, &g.str2, &g.str3 };
+		float* v[] = { g.v1, g.v2, g.v3 };
+		for (int s = 0; s < 3; ++s)
+		{
+			if (s < p.numStrings) str[s]->CopyLane(l, p.strings, s);
+			else
+			{
+				str[s]->SetInterpolation(l, p.interpolation);
+				str[s]->Reset(l);
+			}
+			v[s][l] = s < p.numStrings ? p.v[s] : 0.0f;
+		}
+		g.interp[l] = p.interpolation;
+		g.bridge_stiffness[l] = p.bridge_stiffness;
+		g.bridgeTarget[l] = p.bridgeTarget;
+		g.bridgeStep[l] = p.bridgeStep;
+		g.rampLeft[l] = (float)p.rampLeft;
+		if (g.rampSamples < p.rampLeft) g.rampSamples = p.rampLeft;
+		g.gain[l] = p.gain;
+		g.fadeStep[l] = p.fadeStep;
+		exciters[voice] = p.exciter;
+		activity[voice] = p.activity;
+	}
+	int GetNumGroups() const
+	{
+		return (int)groups.size();
+	}
+	bool IsGroupActive(int gi) const
+	{
+		int first = gi * W;
+		int count = numVoices - first < W ? numVoices - first : W;
+		for (int l = 0; l < count; ++l)
+			if (activity[first + l].IsActive()) return true;
+		return false;
+	}
+	// mixes every active voice into outl/outr
+	void ProcessBlock(float* outl, float* outr, int numSamples)
+	{
+		for (int gi = 0; gi < (int)groups.size(); ++gi)
+		{
+			if (IsGroupActive(gi)) ProcessGroup(gi, outl, outr, numSamples);
+		}
+	}
+	// mixes the voices of one group into outl/outr, groups are independent
+	// of each other and may run on different threads
+	void ProcessGroup(int gi, float* outl, float* outr, int numSamples)
+	{
+		Group& g = groups[gi];
+		int first = gi * W;
+		int count = numVoices - first < W ? numVoices - first : W;
+
+		int strings = 1;
+		for (int l = 0; l < count; ++l)
+			if (activity[first + l].IsActive() && g.strings[l] > strings) strings = g.strings[l];
+		bool uniform = specialised;
+		for (int l = 1; l < W; ++l) uniform &= g.interp[l] == g.interp[0];
+
+		DispatchStrings(strings, [&](auto numStrings) {
+			constexpr int Strings = decltype(numStrings)::value;
+			if (uniform)
+				DispatchInterpolation(g.interp[0], [&](auto mode) { RenderGroup<Strings, decltype(mode)::value, true>(gi, outl, outr, numSamples); });
+			else
+				RenderGroup<Strings, Interpolation::Hermite, false>(gi, outl, outr, numSamples);
+		});
+	}
+};
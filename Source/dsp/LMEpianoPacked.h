@@ -0,0 +1,163 @@
+#pragma once
+
+#include "SimdVec.h"
+#include "LMEpianoBank.h"
+#include "Excitation.h"
+#include "VoiceActivity.h"
+#include "KeyTable.h"
+#include "VoiceDispatch.h"
+
+// one key like LMEpiano, with its strings in the first lanes of one
+// WaveguideLanes<Vec4> (the others stay silent): delay read, disperser,
+// damper, nlapf and saturator of all strings run in one SSE pass per sample,
+// so a voice costs about one string instead of three even when it sounds
+// alone. Keys with fewer strings skip the delay reads of the unused lanes.
+// The bridge sum is taken in the scalar order, the output is bit-identical
+// to the same voice in LMEpianoBank. ProcessBlock() runs a loop compiled for
+// the string count and interpolation of the voice (VoiceDispatch.h).
+class LMEpianoPacked
+{
+private:
+	WaveguideLanes<Vec4> strings;
+	alignas(16) float v[4] = { 0 }; // last output of each string
+	ExcitationPiano exciter;
+	float bridge_stiffness = 0.35f;
+	VoiceActivity activity;
+	float gain = 1.0f;
+	float fadeStep = 0; // gain decrement per sample while fading out
+	float bridgeTarget = 0.35f, bridgeStep = 0; // RampStringCoeffs() ramp
+	int rampLeft = 0;
+	int numStrings = 3;
+	Interpolation interpolation = Interpolation::Hermite;
+	alignas(16) float feed[4] = { 1.0f, 1.0f, 1.0f, 0.0f }; // lanes the bridge feeds
+	friend class LMEpianoBank; // TakeVoice()
+public:
+	void Prepare(float sampleRate, float lowestFreq)
+	{
+		strings.Prepare(sampleRate, lowestFreq);
+		exciter.Prepare(sampleRate);
+		v[0] = v[1] = v[2] = v[3] = 0;
+	}
+	void SetStringParams(float freq, float disp, float nlv, float cross, float unison, float damp_base, float damp_high)
+	{
+		float freqs[3];
+		StringLayout::Freqs(freq, unison, numStrings, freqs);
+		for (int s = 0; s < numStrings; ++s)
+			strings.SetParams(s, freqs[s], disp, nlv, damp_base, damp_high);
+		bridge_stiffness = StringLayout::BridgeStiffness(cross, numStrings);
+		rampLeft = 0;
+	}
+	// c[0..2] are the settings of the three strings, see KeyTable
+	void SetStringCoeffs(const WaveguideCoeffs* c, float cross)
+	{
+		for (int s = 0; s < numStrings; ++s) strings.SetCoeffs(s, c[s]);
+		bridge_stiffness = StringLayout::BridgeStiffness(cross, numStrings);
+		rampLeft = 0;
+	}
+	// moves a sounding voice to new settings, the coefficients ramp linearly
+	// over numSamples
+	void RampStringCoeffs(const WaveguideCoeffs* c, float cross, int numSamples)
+	{
+		for (int s = 0; s < numStrings; ++s) strings.RampCoeffs(s, c[s], numSamples);
+		bridgeTarget = StringLayout::BridgeStiffness(cross, numStrings);
+		if (numSamples <= 1)
+		{
+			bridge_stiffness = bridgeTarget;
+			rampLeft = 0;
+			return;
+		}
+		bridgeStep = (bridgeTarget - bridge_stiffness) / numSamples;
+		rampLeft = numSamples;
+	}
+	void SetInterpolation(Interpolation mode)
+	{
+		interpolation = mode;
+		for (int s = 0; s < 3; ++s) strings.SetInterpolation(s, mode);
+	}
+	void SetOversampling(int factor)
+	{
+		strings.SetOversampling(factor);
+	}
+	// 1, 2 or 3 strings (StringLayout), call after Reset() before the
+	// coefficients of a new note
+	void SetStringCount(int n)
+	{
+		numStrings = n;
+		for (int s = 0; s < 4; ++s) feed[s] = s < n ? 1.0f : 0.0f;
+		strings.SetLanes(n);
+	}
+	void NoteOn(float velocity)
+	{
+		exciter.NoteOn(velocity);
+		activity.Wake();
+		gain = 1.0f;
+		fadeStep = 0;
+	}
+	// fades the voice out linearly over numSamples, then puts it to sleep
+	void Fade(int numSamples)
+	{
+		fadeStep = 1.0f / (numSamples > 0 ? numSamples : 1);
+	}
+	float GetLevel() const
+	{
+		return activity.GetLevel();
+	}
+	void NoteOff()
+	{
+		exciter.NoteOff();
+	}
+	bool IsActive() const
+	{
+		return activity.IsActive();
+	}
+	void ProcessBlock(float* outl, float* outr, int numSamples)
+	{
+		DispatchStrings(numStrings, [&](auto count) {
+			DispatchInterpolation(interpolation, [&](auto mode) {
+				RenderBlock<decltype(count)::value, decltype(mode)::value>(outl, outr, numSamples);
+			});
+		});
+	}
+	void Reset()
+	{
+		for (int s = 0; s < 4; ++s) strings.Reset(s);
+		v[0] = v[1] = v[2] = v[3] = 0;
+	}
+private:
+	template<int Strings, Interpolation Mode>
+	void RenderBlock(float* outl, float* outr, int numSamples)
+	{
+		const StringLayout& layout = StringLayout::Get(Strings);
+		Vec4 out = Vec4::Load(v);
+		Vec4 drive = Vec4::Load(layout.drive);
+		Vec4 lanes = Vec4::Load(feed);
+		Vec4 peak = Vec4::Zero();
+		for (int n = 0; n < numSamples; ++n)
+		{
+			float exc = exciter.ProcessSample();
+			if (rampLeft > 0)
+			{
+				if (--rampLeft == 0) bridge_stiffness = bridgeTarget;
+				else bridge_stiffness += bridgeStep;
+			}
+
+			float v_bridge = (v[0] + v[1] + v[2]) * bridge_stiffness;
+			out = strings.ProcessSample<Strings, Mode>(out - Vec4::Set(v_bridge) * lanes + Vec4::Set(exc) * drive);
+			out.Store(v);
+
+			float o = (v[0] * layout.pickup[0] + v[1] * layout.pickup[1] + v[2] * layout.pickup[2]) * gain;
+			outl[n] = o;
+			outr[n] = o;
+			peak = Vec4::Max(peak, Vec4::Abs(out));
+			if (fadeStep > 0) gain = fmaxf(gain - fadeStep, 0.0f);
+		}
+		alignas(16) float peaks[4];
+		peak.Store(peaks);
+		activity.Update(fmaxf(peaks[0], fmaxf(peaks[1], peaks[2])), exciter.IsFinished(), numSamples);
+		if (fadeStep > 0 && gain <= 0)
+		{
+			activity.Sleep();
+			fadeStep = 0;
+		}
+	}
+};
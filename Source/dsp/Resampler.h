@@ -0,0 +1,130 @@
+#pragma once
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "SimdVec.h"
+
+// streaming stereo sample rate converter for an arbitrary ratio.
+// Kaiser windowed sinc, Taps taps per output sample, the coefficients come from
+// a table of NumPhases phases with linear interpolation between neighbouring
+// phases; the dot product runs on VecN. The cutoff sits at 0.45 of the lower
+// of the two rates, 48k -> 96k stays within -90dB of the ideal signal up to
+// 10kHz and rolls off above 18kHz. Latency is Taps / 2 input samples.
+class Resampler
+{
+public:
+	constexpr static int Taps = 32;
+	constexpr static int NumPhases = 256;
+private:
+	std::vector<float> table; // (NumPhases + 1) x Taps
+	std::vector<float> histL, histR;
+	int histLen = 0; // valid samples in histL/histR
+	double pos = 0; // input position of the next output sample in hist
+	double step = 1; // input samples per output sample
+
+	static double BesselI0(double x)
+	{
+		double sum = 1, term = 1;
+		for (int k = 1; k < 32; ++k)
+		{
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+	inline float Dot(const float* x, const float* c0, const float* c1, float frac) const
+	{
+		VecN acc = VecN::Zero();
+		VecN f = VecN::Set(frac);
+		for (int j = 0; j < Taps; j += VecN::Width)
+		{
+			VecN a = VecN::LoadU(c0 + j);
+			VecN c = a + (VecN::LoadU(c1 + j) - a) * f;
+			acc = acc + VecN::LoadU(x + j) * c;
+		}
+		return acc.Sum();
+	}
+public:
+	// allocates, call from prepareToPlay. maxOutput is the largest number of
+	// output samples requested per Process() call
+	void Prepare(double inputRate, double outputRate, int maxOutput)
+	{
+		step = inputRate / outputRate;
+		double cutoff = 0.45 * (inputRate < outputRate ? 1.0 : outputRate / inputRate); // in input samples
+		const double beta = 9.0;
+
+		table.assign((size_t)(NumPhases + 1) * Taps, 0.0f);
+		for (int p = 0; p <= NumPhases; ++p)
+		{
+			double frac = (double)p / NumPhases;
+			for (int j = 0; j < Taps; ++j)
+			{
+				// tap j reads x[i - Taps / 2 + 1 + j], its distance to the output time
+				double t = (double)(j - Taps / 2 + 1) - frac;
+				double sinc = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+				double w = t / (Taps / 2);
+				double window = fabs(w) >= 1 ? 0 : BesselI0(beta * sqrt(1 - w * w)) / BesselI0(beta);
+				table[(size_t)p * Taps + j] = (float)(sinc * window);
+			}
+		}
+
+		int maxInput = (int)ceil(maxOutput * step) + Taps + 2;
+		histL.assign(maxInput + Taps, 0.0f);
+		histR.assign(maxInput + Taps, 0.0f);
+		Reset();
+	}
+	void Reset()
+	{
+		std::fill(histL.begin(), histL.end(), 0.0f);
+		std::fill(histR.begin(), histR.end(), 0.0f);
+		histLen = Taps;
+		pos = Taps / 2;
+	}
+	int GetLatencyInputSamples() const
+	{
+		return Taps / 2;
+	}
+	// number of input samples that have to be pushed before Process(numOutput)
+	int GetInputNeeded(int numOutput) const
+	{
+		int last = (int)(pos + (numOutput - 1) * step);
+		int need = last + Taps / 2 + 1 - histLen;
+		return need > 0 ? need : 0;
+	}
+	// where the next 'count' input samples have to be written
+	float* GetInputL() { return &histL[histLen]; }
+	float* GetInputR() { return &histR[histLen]; }
+	void CommitInput(int count)
+	{
+		histLen += count;
+	}
+	void Process(float* outl, float* outr, int numOutput)
+	{
+		for (int n = 0; n < numOutput; ++n)
+		{
+			int i = (int)pos;
+			double fp = (pos - i) * NumPhases;
+			int p = (int)fp;
+			float frac = (float)(fp - p);
+			const float* c0 = &table[(size_t)p * Taps];
+			const float* c1 = c0 + Taps;
+			int first = i - Taps / 2 + 1;
+			outl[n] = Dot(&histL[first], c0, c1, frac);
+			outr[n] = Dot(&histR[first], c0, c1, frac);
+			pos += step;
+		}
+
+		// keep only the history the next output still needs
+		int drop = (int)pos - Taps / 2 + 1;
+		if (drop > 0)
+		{
+			if (drop > histLen) drop = histLen;
+			memmove(histL.data(), histL.data() + drop, sizeof(float) * (histLen - drop));
+			memmove(histR.data(), histR.data() + drop, sizeof(float) * (histLen - drop));
+			histLen -= drop;
+			pos -= drop;
+		}
+	}
+};
@@ -2,8 +2,10 @@
 
 #include <vector>
 #include <algorithm>
+#define _USE_MATH_DEFINES
 #include <math.h>
 #include <string.h>
+#include "SimdVec.h"
 
 class RigidStringFDTD {
 private:
@@ -23,20 +25,113 @@ private:
 	float* y_prev = y0;
 	float* y = y1;
 	float* y_next = y2;
+	float lapPrev[2000] = { 0 }; // see ProcessPoints()
+	// highest point written since Reset(), the ones above are all zero
+	int used = 0;
 
 	// ߽
 	float leftV = 0, rightV = 0;
 	float leftN = 0, rightN = 0;
 
+	// the stencil for V::Width points from i on, same arithmetic as the plain
+	// float loop so every V gives the same result. lapPrev[] holds the
+	// laplacian of y_prev (it was y one sample ago) and takes the one of y
+	template<typename V>
+	inline void ProcessPoints(int i, float gainLimit)
+	{
+		V curr = V::LoadU(y + i);
+		V prev = V::LoadU(y_prev + i);
+		V left = V::LoadU(y + i - 1);
+		V right = V::LoadU(y + i + 1);
+
+		// --- ޸ģֲ ---
+		// ֲӦ䣨бʣʹ (y[i+1]-y[i-1]) / 2h Ľ
+		V slope = right - left;
+		V local_strain = slope * slope;
+
+		// αϵã
+		// һ棬ʹ fast_exp 򵥵Ʒֹը
+		// nonlinear_coeff ԽͷԽըƵԽḻ
+		V nonlin_gain = V::Set(1.0f) + V::Set(nonlinear_coeff) * local_strain;
+
+		// ȫ޷ֲֹȶԼ
+		//  S * nonlin_gain + 4K > 0.9ǿ޷
+		V over = V::Less(V::Set(0.95f), V::Set(S) * nonlin_gain + V::Set(4.0f * K));
+		nonlin_gain = V::Select(over, V::Set(gainLimit), nonlin_gain);
+
+		V S_local = V::Set(S) * nonlin_gain;
+
+		// ---  ---
+		V laplacian_curr = right - V::Set(2.0f) * curr + left;
+		V term_tension = S_local * laplacian_curr;
+		V term_stiff = V::Set(-K) * (V::LoadU(y + i + 2) - V::Set(4.0f) * right + V::Set(6.0f) * curr - V::Set(4.0f) * left + V::LoadU(y + i - 2));
+
+		// ߼ֲ
+		V term_damp_high = V::Set(R_high) * (laplacian_curr - V::LoadU(lapPrev + i));
+		laplacian_curr.StoreU(lapPrev + i);
+
+		V physics = term_tension + term_stiff + term_damp_high;
+		((V::Set(2.0f) * curr - prev * V::Set(1.0f - R_base) + physics) / V::Set(1.0f + R_base)).StoreU(y_next + i);
+	}
+	// lapPrev[] from y_prev, after N changed
+	void UpdateLaplacian()
+	{
+		for (int i = 2; i <= N - 2; ++i)
+			lapPrev[i] = (y_prev[i + 1] - 2.0f * y_prev[i] + y_prev[i - 1]);
+	}
+
+	// S and K that tune the lowest mode of an n point grid to freq: a mode
+	// sin(k pi i / n) of the scheme turns at cos(w) sqrt(1 - R^2) =
+	// 1 - 2 S sin^2(t) (1 + 4 (K / S) sin^2(t)), t = k pi / (2 n), and K / S =
+	// B n^2 / pi^2 gives the partials k f sqrt(1 + B k^2) of a stiff string.
+	// Returns whether S + 4K <= 0.75
+	bool GridCoeffs(int n, double freq, double B, double R, float& S, float& K) const
+	{
+		double t = sin(M_PI / (2.0 * n));
+		double beta = B * n * n / (M_PI * M_PI);
+		double s = (1.0 - cos(2.0 * M_PI * freq * dt) * sqrt(1.0 - R * R)) / (2.0 * t * t * (1.0 + 4.0 * beta * t * t));
+		S = (float)s;
+		K = (float)(s * beta);
+		// ȶо
+		// ע⣺Ի S 0.75 ǱҪģֹʱ
+		return S + 4.0f * K <= 0.75f;
+	}
+
 public:
+	// grid sizes SetParams() chooses from. 4 points still play the top key
+	// at 44.1k, every key gets the grid that tunes it
+	constexpr static int MinGrid = 4;
+	constexpr static int MaxGrid = 1500;
+	// disp sets the inharmonicity B = (disp * freq / InharmonicityFreq)^2,
+	// 7e-4 at C4 and 0.04 at C7 for disp 1
+	constexpr static float InharmonicityFreq = 10000.0f;
+	// largest loop gain of the bridge: SetBoundary() sets the bridge end to
+	// the bridge value, and the end follows the point next to it one sample
+	// late. That is stable while the end moves less than that point and with
+	// it (pushed against it the highest modes grow at any strength), so the
+	// voice keeps the bridge sum of its strings (strings * bridge stiffness,
+	// twice a string at cross 1) at most this. Below it the bridge is unchanged
+	constexpr static float MaxBridgeGain = 0.9f;
+	// hammer and pickup position as a fraction of the length, from the bridge
+	constexpr static float DefaultStrikePos = 0.125f;
+	constexpr static float DefaultPickupPos = 0.2f;
+
 	RigidStringFDTD(float sampleRate = 48000.0)
 		: fs(sampleRate), dt(1.0f / sampleRate)
 	{
 		Reset();
 	}
 
+	// the grid is sized by SetParams(), up to MaxGrid points for any key
+	void Prepare(float sampleRate)
+	{
+		fs = sampleRate;
+		dt = 1.0f / sampleRate;
+		Reset();
+	}
+
 	// ò¼ϵͳȶ
-	void SetParams(float freq, float disp, float nonlinearV, float damp_base, float damp_high, float peakin, float peakout)
+	void SetParams(float freq, float disp, float nonlinearV, float damp_base, float damp_high, float peakin = DefaultStrikePos, float peakout = DefaultPickupPos)
 	{
 		float safeFreq = freq;
 
@@ -45,47 +140,59 @@ public:
 		nonlinear_coeff = nonlinearV * 1.0f;
 
 		// --- 2. Զ N У׼ ---
-		int targetN = 1500;
-		bool stable = false;
-		float h, currentS, currentK;
-
-		while (!stable && targetN >= 10) {
-			h = 1.0f / (float)targetN;
-			currentS = powf((safeFreq * 250.0f) * dt / h, 2);
-			currentK = powf((disp * safeFreq * safeFreq * 5.0f) * dt / powf(h, 2), 2);
-
-			// ȶо
-			// ע⣺Ի S 0.75 ǱҪģֹʱ
-			if (currentS + 4.0f * currentK <= 0.75f) {
-				stable = true;
+		// the largest N <= MaxGrid that passes GridCoeffs(). With sin(t) ~ t,
+		// S = c u / (1 + B) and K / S = B u / pi^2 for u = N^2 and
+		// c = 2 (1 - cos(w)) / pi^2, so u is the root of
+		// 4 B c u^2 / pi^2 + c u = 0.75 (1 + B). sin(t) < t only makes the grid
+		// stiffer, so floor(sqrt(u)) is never below that N and at most one above
+		// it (checked for every key +-48 semitones from 22.05k to 192k), one
+		// exact test settles it
+		double B = disp * safeFreq / InharmonicityFreq;
+		B *= B;
+		R_base = damp_base * freq * 0.00001f;
+		double c = 2.0 * (1.0 - cos(2.0 * M_PI * safeFreq * dt)) / (M_PI * M_PI), q = 4.0 * B / (M_PI * M_PI);
+		double u = c > 0.0 ? 1.5 * (1.0 + B) / (c + sqrt(c * c + 3.0 * c * q * (1.0 + B))) : (double)MaxGrid * MaxGrid;
+		int targetN = u >= (double)MaxGrid * MaxGrid ? MaxGrid : (int)sqrt(u);
+		if (targetN < MinGrid - 1) targetN = MinGrid - 1;
+		// N is chosen without the damping, so a release doesn't move the grid
+		float currentS, currentK;
+		if (targetN >= MinGrid && !GridCoeffs(targetN, safeFreq, B, 0.0, currentS, currentK)) --targetN;
+
+		if (targetN < MinGrid) {
+			// too high or too stiff for the coarsest grid: it keeps the pitch and
+			// gets the largest stable K / S, or S = 0.75 without stiffness when the
+			// note is above what MinGrid points can play (goes flat)
+			targetN = MinGrid;
+			double t = sin(M_PI / (2.0 * MinGrid)), t2 = t * t;
+			double x = (1.0 - cos(2.0 * M_PI * safeFreq * dt) * sqrt(1.0 - (double)R_base * R_base)) / 2.0;
+			if (x > 0.75 * t2 * t2) {
+				// S (1 + 4 K / S) <= 0.75 solved for K / S, a hair inside
+				double beta = 0.999 * (0.75 * t2 - x) / (4.0 * (x - 0.75 * t2 * t2));
+				B = std::min(B, std::max(beta, 0.0) * M_PI * M_PI / ((double)MinGrid * MinGrid));
 			}
-			else {
-				targetN--;
+			if (!GridCoeffs(targetN, safeFreq, B, R_base, currentS, currentK)) {
+				currentS = 0.75f;
+				currentK = 0;
 			}
 		}
-
-		if (!stable) {
-			targetN = 10;
-			h = 1.0f / (float)targetN;
-			currentS = powf((safeFreq * 250.0f) * dt / h, 2);
-			currentK = powf((disp * safeFreq * safeFreq * 5.0f) * dt / powf(h, 2), 2);
-			while (currentS + 4.0f * currentK > 0.75f) {
-				currentS *= 0.999f;
-				currentK *= 0.99f;
-			}
+		else {
+			GridCoeffs(targetN, safeFreq, B, R_base, currentS, currentK);
 		}
 
 		N = targetN;
+		if (N > used) used = N;
 		S = currentS;
 		K = currentK;
 
-		R_base = damp_base * freq * 0.00001f;
 		R_high = damp_high * 0.0005f;
 
 		strike_pos = std::max(2, std::min(N - 2, (int)(peakin * N)));
 		pickup_pos = std::max(1, std::min(N - 1, (int)(peakout * N)));
+		UpdateLaplacian();
 	}
 
+	// left is the bridge the voice built from GetLeftBoundary() of its
+	// strings, see MaxBridgeGain
 	void SetBoundary(float left, float right)
 	{
 		leftN = left;
@@ -94,6 +201,7 @@ public:
 
 	float GetLeftBoundary() const { return leftV; }
 	float GetRightBoundary() const { return rightV; }
+	int GetGridSize() const { return N; }
 
 	// 
 	inline float ProcessSample(float excitation)
@@ -106,41 +214,14 @@ public:
 		y[strike_pos + 1] += amp * 0.5f;
 
 		// 2. ļѭ
-		for (int i = 2; i <= N - 2; ++i)
-		{
-			float curr = y[i];
-			float prev = y_prev[i];
-
-			// --- ޸ģֲ ---
-			// ֲӦ䣨бʣʹ (y[i+1]-y[i-1]) / 2h Ľ
-			float slope = (y[i + 1] - y[i - 1]);
-			float local_strain = slope * slope;
-
-			// αϵã
-			// һ棬ʹ fast_exp 򵥵Ʒֹը
-			// nonlinear_coeff ԽͷԽըƵԽḻ
-			float nonlin_gain = 1.0f + (nonlinear_coeff * local_strain);
-
-			// ȫ޷ֲֹȶԼ
-			//  S * nonlin_gain + 4K > 0.9ǿ޷
-			if (S * nonlin_gain + 4.0f * K > 0.95f) {
-				nonlin_gain = (0.95f - 4.0f * K) / S;
-			}
-
-			float S_local = S * nonlin_gain;
-
-			// ---  ---
-			float term_tension = S_local * (y[i + 1] - 2.0f * curr + y[i - 1]);
-			float term_stiff = -K * (y[i + 2] - 4.0f * y[i + 1] + 6.0f * curr - 4.0f * y[i - 1] + y[i - 2]);
-
-			// ߼ֲ
-			float laplacian_curr = (y[i + 1] - 2.0f * curr + y[i - 1]);
-			float laplacian_prev = (y_prev[i + 1] - 2.0f * prev + y_prev[i - 1]);
-			float term_damp_high = R_high * (laplacian_curr - laplacian_prev);
-
-			float physics = term_tension + term_stiff + term_damp_high;
-			y_next[i] = (2.0f * curr - prev * (1.0f - R_base) + physics) / (1.0f + R_base);
-		}
+		// VecN::Width points at a time, the rest one by one. The stability
+		// clamp is a select, not a branch
+		float gainLimit = (0.95f - 4.0f * K) / S;
+		int i = 2;
+		for (; i + VecN::Width - 1 <= N - 2; i += VecN::Width)
+			ProcessPoints<VecN>(i, gainLimit);
+		for (; i <= N - 2; ++i)
+			ProcessPoints<Vec1>(i, gainLimit);
 
 		// ע
 		//y_next[strike_pos] += excitation * 0.02f;
@@ -171,10 +252,16 @@ public:
 		}
 	}
 
+	// clears the points the grids since the last Reset() used, not the
+	// whole arrays
 	void Reset()
 	{
-		memset(y0, 0, sizeof(y0));
-		memset(y1, 0, sizeof(y1));
-		memset(y2, 0, sizeof(y2));
+		size_t bytes = sizeof(float) * (used + 1);
+		memset(y0, 0, bytes);
+		memset(y1, 0, bytes);
+		memset(y2, 0, bytes);
+		memset(lapPrev, 0, bytes);
+		used = N;
+		leftV = rightV = leftN = rightN = 0;
 	}
 };
\ No newline at end of file
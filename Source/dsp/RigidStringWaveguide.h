@@ -2,6 +2,8 @@
 
 #include <complex>
 #include "DelayLine.h"
+#include "FastMath.h"
+#include "HalfBand.h"
 
 class Disperser
 {
@@ -21,10 +23,18 @@ public:
 	{
 		this->a = a;
 	}
+	float GetA() const
+	{
+		return a;
+	}
 	void SetStages(int stages)
 	{
 		this->stages = stages;
 	}
+	void SetSampleRate(float sampleRate)
+	{
+		this->sampleRate = sampleRate;
+	}
 	inline float ProcessSample(float x)
 	{
 		for (int i = 0; i < stages; ++i) {
@@ -34,7 +44,23 @@ public:
 		}
 		return x;
 	}
+	// ProcessSample() with the stage count fixed at compile time, unrolled
+	template<int Stages>
+	inline float ProcessSample(float x)
+	{
+		for (int i = 0; i < Stages; ++i)
+		{
+			float out = -a * x + zs[i];
+			zs[i] = x + a * out;
+			x = out;
+		}
+		return x;
+	}
 	float GetPhaseDelay(float freq)
+	{
+		return PhaseDelay(a, stages, freq, sampleRate);
+	}
+	static float PhaseDelay(float a, int stages, float freq, float sampleRate)
 	{
 		if (freq <= 0.0f) return (1.0f - a) / (1.0f + a) * (float)stages;
 
@@ -60,90 +86,329 @@ public:
 	}
 };
 
-class Damper
+// the linear part of the string loop in one section, the dispersion allpass
+// (two Disperser stages of coefficient a) followed by the damping lowpass:
+//   H(z) = g / (1 + h) * (1 + h z^-1) * ((-a + z^-1) / (1 - a z^-1))^2
+// A transposed direct form biquad of H would be shortest, but its
+// coefficients rounded to float move the gain near DC by up to 1e-3 at full
+// dispersion (a = 0.993), which the loop turns into a wrong decay time. The
+// double pole is taken out of the section instead, with P = 1 / (1 - a z^-1)
+//   H = n0 + z^-1 (al + be z^-1 P + ga z^-2 P^2)
+// be and ga carry powers of 1 - a^2, so every term stays near 1 and the
+// output is within the rounding of the cascade. Only a constant input shows
+// a difference: the recursions stop within an ulp of their fixed point, the
+// DC gain is 2.7e-5 low at a = 0.993 (the cascade is exact there, a loop
+// losing 0.5% per pass decays 0.5% faster at DC). 6 multiplies and no divide
+// per sample, the two recursions are one multiply-add each. Every lane of V
+// is an independent filter
+template<typename V>
+class LoopFilter
 {
 private:
-	float sampleRate = 48000;
-	float z = 0;
-	float dampBase = 1.0, dampHigh = 1.0;
+	constexpr static int W = V::Width;
+	alignas(32) float a[W], n0[W], al[W], be[W], ga[W];
+	alignas(32) float s[W], w[W], u[W];
+	template<typename> friend class LoopFilter;
+
+	static inline void Design(V a, V g, V h, V& n0, V& al, V& be, V& ga)
+	{
+		V one = V::Set(1.0f);
+		V a2 = a * a;
+		V e = (one - a) * (one + a); // 1 - a^2
+		g = g / (one + h);
+		n0 = g * a2;
+		al = g * (a2 * h - V::Set(2.0f) * a * e);
+		be = g * e * (one - V::Set(3.0f) * a2 - V::Set(2.0f) * a * h);
+		ga = g * e * e * (a + h);
+	}
 public:
-	Damper(float sampleRate = 48000) :sampleRate(sampleRate)
+	LoopFilter()
 	{
+		SetCoeffs(V::Zero(), V::Set(1.0f), V::Zero());
+		Reset();
 	}
-	void SetDampBase(float dampBase) { this->dampBase = 1.0 - dampBase; }
-	void SetDampHigh(float dampHigh) { this->dampHigh = dampHigh; }
-	inline float ProcessSample(float x)
+	// allpass coefficient a, gain g (1 - WaveguideCoeffs::dampBase) and
+	// lowpass h for every lane
+	inline void SetCoeffs(V a, V g, V h)
 	{
-		float y = (x + z * dampHigh) / (1.0f + dampHigh) * dampBase;
-		z = x;
-		return y;
+		V n0, al, be, ga;
+		Design(a, g, h, n0, al, be, ga);
+		a.Store(this->a);
+		n0.Store(this->n0);
+		al.Store(this->al);
+		be.Store(this->be);
+		ga.Store(this->ga);
 	}
-	float GetPhaseDelay(float freq)
+	void SetCoeffs(int lane, float a, float g, float h)
 	{
-		float omega = 2.0f * (float)M_PI * freq / sampleRate;
-		std::complex<float> z_inv(cosf(-omega), sinf(-omega));
-		std::complex<float> H_part = 1.0f + dampHigh * z_inv;
-		float phase = std::arg(H_part);
-		return -phase / omega;
+		Vec1 n0, al, be, ga;
+		LoopFilter<Vec1>::Design(Vec1::Set(a), Vec1::Set(g), Vec1::Set(h), n0, al, be, ga);
+		this->a[lane] = a;
+		this->n0[lane] = n0.v;
+		this->al[lane] = al.v;
+		this->be[lane] = be.v;
+		this->ga[lane] = ga.v;
+	}
+	inline V Process(V x)
+	{
+		V a = V::Load(this->a), w = V::Load(this->w), u = V::Load(this->u);
+		V y = V::Load(n0) * x + V::Load(s);
+		(V::Load(al) * x + V::Load(be) * w + V::Load(ga) * u).Store(s);
+		(w + a * u).Store(this->u);
+		(x + a * w).Store(this->w);
+		return y;
 	}
 	void Reset()
 	{
-		z = 0;
+		for (int l = 0; l < W; ++l) Reset(l);
+	}
+	void Reset(int lane)
+	{
+		s[lane] = w[lane] = u[lane] = 0;
+	}
+	// lane takes over coefficients and state of lane 'from' of a filter of
+	// any width
+	template<typename U>
+	void CopyLane(int lane, const LoopFilter<U>& src, int from)
+	{
+		a[lane] = src.a[from];
+		n0[lane] = src.n0[from];
+		al[lane] = src.al[from];
+		be[lane] = src.be[from];
+		ga[lane] = src.ga[from];
+		s[lane] = src.s[from];
+		w[lane] = src.w[from];
+		u[lane] = src.u[from];
+	}
+	// phase delay of H in samples, the sum of the phases of its factors so it
+	// doesn't wrap
+	static float PhaseDelay(float a, float h, float freq, float sampleRate)
+	{
+		float omega = 2.0f * (float)M_PI * freq / sampleRate;
+		std::complex<float> z_inv(cosf(-omega), sinf(-omega));
+		float phase = std::arg(1.0f + h * z_inv);
+		return Disperser::PhaseDelay(a, 2, freq, sampleRate) - phase / omega;
 	}
 };
 
+// per-note loop settings of a RigidStringWaveguide, see ComputeCoeffs()
+struct WaveguideCoeffs
+{
+	float delay = 2.0f;    // loop delay in samples after filter compensation
+	float dispA = 0.0f;    // LoopFilter allpass coefficient
+	float dampBase = 0.0f; // LoopFilter broadband loss
+	float dampHigh = 0.0f; // LoopFilter lowpass amount
+	float overdrive = 0.0f;
+};
+
 class RigidStringWaveguide
 {
 private:
 	float sampleRate = 48000;
-	DelayLine<48000> delay;
-	Disperser disperser;
+	DelayLine delay;
+	LoopFilter<Vec1> loop; // disperser and damper
 	Disperser nlapf;
-	Damper damper;
 	float fb = 0;
+	float lastOut = 0;
 	float overdrive = 0.0;
+	// runs nlapf and the saturator at 2x/4x, see SetOversampling()
+	Oversampler<Vec1> oversampler;
+	float nlapfA = 0; // base rate nlapf coefficient while oversampled
+
+	// filter coefficients in use, and the linear ramp of RampCoeffs()
+	WaveguideCoeffs coeffs, rampTarget, rampStep;
+	int rampLeft = 0;
+
+	void ApplyFilters(const WaveguideCoeffs& c)
+	{
+		loop.SetCoeffs(0, c.dispA, 1.0 - c.dampBase, c.dampHigh);
+		overdrive = c.overdrive;
+	}
+	inline void StepRamp()
+	{
+		if (--rampLeft == 0)
+		{
+			coeffs = rampTarget;
+		}
+		else
+		{
+			coeffs.dispA += rampStep.dispA;
+			coeffs.dampBase += rampStep.dampBase;
+			coeffs.dampHigh += rampStep.dampHigh;
+			coeffs.overdrive += rampStep.overdrive;
+		}
+		ApplyFilters(coeffs);
+	}
+	// nlapf and saturator at the oversampled rate, same as the base rate code
+	// in ProcessSample() with the nlapf coefficient moved to the high rate
+	inline Vec1 SaturateOversampled(Vec1 x)
+	{
+		Vec1 a = Atan<AtanTier>(x * x * x * Vec1::Set(8.0f)) * Vec1::Set(2.0 / M_PI) * Vec1::Set(overdrive);
+		nlapfA = a.v;
+		nlapf.SetA(NlapfAtRate(a, Vec1::Set((float)oversampler.GetFactor())).v);
+		x.v = nlapf.ProcessSample<NlapfStages>(x.v);
+		return Atan<AtanTier>(x * Vec1::Set(0.2f)) * Vec1::Set(5.0f);
+	}
 public:
+	constexpr static float DefaultLowestFreq = 16.0f;
+	// allpass stages of the nlapf
+	constexpr static int NlapfStages = 2;
+	// accuracy of the saturator and nlapf atan, LMEpianoBank uses the same tier.
+	// Medium stays within -60dB of atanf in the rendered note (High: -90dB)
+	constexpr static MathTier AtanTier = MathTier::Medium;
+
 	RigidStringWaveguide(float sampleRate = 48000.0)
-		: sampleRate(sampleRate)
+		: sampleRate(sampleRate), delay((int)(sampleRate / DefaultLowestFreq) + 1)
 	{
 	}
-	void SetParams(float freq, float disp, float overdrive, float damp_base, float damp_high)
+	// sets the engine rate and sizes the loop delay for one period of
+	// lowestFreq, lower notes are clamped
+	void Prepare(float sampleRate, float lowestFreq)
+	{
+		this->sampleRate = sampleRate;
+		nlapf.SetSampleRate(sampleRate);
+		delay.Resize((int)ceilf(sampleRate / lowestFreq) + 1);
+	}
+	void SetInterpolation(Interpolation mode)
+	{
+		delay.SetInterpolation(mode);
+	}
+	// runs nlapf and the saturator at factor (1, 2 or 4) times the rate to
+	// keep their harmonics from aliasing. The loop delay must be recomputed
+	// with the same factor (ComputeDelay()), the stage restarts from silence
+	void SetOversampling(int factor)
+	{
+		if (factor == oversampler.GetFactor()) return;
+		oversampler.SetFactor(factor);
+		nlapf.Reset();
+		nlapfA = 0;
+	}
+	// the nlapf coefficient a at factor times the rate, with the same low
+	// frequency delay (1 + a) / (1 - a) in base rate samples per stage
+	template<typename V>
+	static inline V NlapfAtRate(V a, V factor)
+	{
+		V one = V::Set(1.0f);
+		V p = factor * (one + a), m = one - a;
+		return (p - m) / (p + m);
+	}
+	// the key independent part of ComputeCoeffs(), delay left at its default
+	static WaveguideCoeffs ComputeFilterCoeffs(float disp, float overdrive, float damp_base, float damp_high)
+	{
+		WaveguideCoeffs c;
+		c.dispA = 1.0 - expf(-disp * 5.0f);
+		c.dampBase = expf((damp_base - 1.0f) * 8.0f) - expf(-8.0f);
+		c.dampHigh = expf((damp_high - 1.0f) * 8.0f) - expf(-8.0f);
+		c.overdrive = overdrive;
+		return c;
+	}
+	// loop delay that tunes the string to freq once the phase delay of the
+	// filters is subtracted, nlapfA is the nlapf coefficient to compensate.
+	// Oversampled, the nlapf runs at the high rate behind the half-band filters
+	static float ComputeDelay(float sampleRate, float freq, float dispA, float dampHigh, float nlapfA, int oversampling = 1)
 	{
-		disp = 1.0 - expf(-disp * 5.0f);
-		disperser.SetA(disp);
-		disperser.SetStages(2);
-		nlapf.SetStages(2);
-
-		damp_base = expf((damp_base - 1.0f) * 8.0f) - expf(-8.0f);
-		damp_high = expf((damp_high - 1.0f) * 8.0f) - expf(-8.0f);
-		damper.SetDampBase(damp_base);
-		damper.SetDampHigh(damp_high);
-
 		float totalPeriod = sampleRate / freq;
-		float dispDelay = disperser.GetPhaseDelay(freq);
-		float dampDelay = damper.GetPhaseDelay(freq);
-		float nlapfDelay = nlapf.GetPhaseDelay(freq);
-		float t = totalPeriod - dispDelay - dampDelay - nlapfDelay;
+		float loopDelay = LoopFilter<Vec1>::PhaseDelay(dispA, dampHigh, freq, sampleRate);
+		float nlapfDelay;
+		if (oversampling > 1)
+		{
+			float f = (float)oversampling;
+			float a = NlapfAtRate(Vec1::Set(nlapfA), Vec1::Set(f)).v;
+			nlapfDelay = Disperser::PhaseDelay(a, NlapfStages, freq, sampleRate * f) / f + Oversampler<Vec1>::PhaseDelay(oversampling, freq, sampleRate);
+		}
+		else
+		{
+			nlapfDelay = Disperser::PhaseDelay(nlapfA, NlapfStages, freq, sampleRate);
+		}
+		// the string output reaches the input one sample later (bridge feedback)
+		float t = totalPeriod - loopDelay - nlapfDelay - 1.0f;
 		if (t < 2.0f) t = 2.0f;
-		delay.SetDelayTime(t);
-
-		this->overdrive = overdrive;
+		return t;
+	}
+	// nlapfA is the current nlapf coefficient, its phase delay is compensated too
+	static WaveguideCoeffs ComputeCoeffs(float sampleRate, float freq, float disp, float overdrive, float damp_base, float damp_high, float nlapfA, int oversampling = 1)
+	{
+		WaveguideCoeffs c = ComputeFilterCoeffs(disp, overdrive, damp_base, damp_high);
+		c.delay = ComputeDelay(sampleRate, freq, c.dispA, c.dampHigh, nlapfA, oversampling);
+		return c;
+	}
+	void SetParams(float freq, float disp, float overdrive, float damp_base, float damp_high)
+	{
+		SetCoeffs(ComputeCoeffs(sampleRate, freq, disp, overdrive, damp_base, damp_high,
+			oversampler.GetFactor() > 1 ? nlapfA : nlapf.GetA(), oversampler.GetFactor()));
+	}
+	void SetCoeffs(const WaveguideCoeffs& c)
+	{
+		nlapf.SetStages(NlapfStages);
+		coeffs = c;
+		rampLeft = 0;
+		ApplyFilters(c);
+		delay.SetDelayTime(c.delay);
+	}
+	// moves a sounding string to c: the filter coefficients ramp linearly over
+	// numSamples, the delay glides like after any SetDelayTime()
+	void RampCoeffs(const WaveguideCoeffs& c, int numSamples)
+	{
+		if (numSamples <= 1)
+		{
+			SetCoeffs(c);
+			return;
+		}
+		rampTarget = c;
+		rampStep.dispA = (c.dispA - coeffs.dispA) / numSamples;
+		rampStep.dampBase = (c.dampBase - coeffs.dampBase) / numSamples;
+		rampStep.dampHigh = (c.dampHigh - coeffs.dampHigh) / numSamples;
+		rampStep.overdrive = (c.overdrive - coeffs.overdrive) / numSamples;
+		rampLeft = numSamples;
+		delay.SetDelayTime(c.delay);
+	}
+	// bridge coupling, the same calls as RigidStringFDTD with the bridge at the
+	// left end: GetLeftBoundary() is the last output, SetBoundary() takes the
+	// bridge displacement and the next input is the output less it. The loop
+	// is one round trip of the string, its far end (agraffe) is a fixed
+	// reflection inside the loop with no input of its own, so the right value
+	// is ignored (the voice passes 0 to both engines)
+	void SetBoundary(float left, [[maybe_unused]] float right)
+	{
+		fb = -left + lastOut;
+	}
+	float GetLeftBoundary() const
+	{
+		return lastOut;
+	}
+	inline float ProcessSample(float excitation)
+	{
+		switch (delay.GetInterpolation())
+		{
+		case Interpolation::Linear: return ProcessSample<Interpolation::Linear>(excitation);
+		case Interpolation::Thiran: return ProcessSample<Interpolation::Thiran>(excitation);
+		case Interpolation::Sinc: return ProcessSample<Interpolation::Sinc>(excitation);
+		default: return ProcessSample<Interpolation::Hermite>(excitation);
+		}
 	}
+	// ProcessSample() with the SetInterpolation() mode as a constant, for
+	// callers that pick it once per block (VoiceDispatch.h)
+	template<Interpolation Mode>
 	inline float ProcessSample(float excitation)
 	{
+		if (rampLeft > 0) StepRamp();
 		float in = excitation + fb;
-		delay.WriteSample(in);
-		float out = damper.ProcessSample(disperser.ProcessSample(delay.ReadSample()));
-		nlapf.SetA(atanf(out * out * out * 8.0) / M_PI * 2.0 * overdrive);//ǿʱߴг
-		out = nlapf.ProcessSample(out);//ʱȫͨʵַȼѹҹģ
+		delay.WriteSample<Mode>(in);
+		float out = loop.Process(Vec1{ delay.ReadSample() }).v;
+		if (oversampler.GetFactor() > 1)
+			return lastOut = oversampler.Process(Vec1{ out }, [this](Vec1 x) { return SaturateOversampled(x); }).v;
+		nlapf.SetA(Atan<AtanTier>(out * out * out * 8.0f) * (float)(2.0 / M_PI) * overdrive);//ǿʱߴг
+		out = nlapf.ProcessSample<NlapfStages>(out);//ʱȫͨʵַȼѹҹģ
 		//fb = out;Լ
-		return atanf(out / 5.0) * 5.0;//
+		return lastOut = Atan<AtanTier>(out * 0.2f) * 5.0f;//
 	}
 	void Reset()
 	{
 		delay.Reset();
-		disperser.Reset();
-		damper.Reset();
+		loop.Reset();
+		nlapf.Reset();
+		oversampler.Reset();
 		fb = 0;
+		lastOut = 0;
 	}
 };
\ No newline at end of file
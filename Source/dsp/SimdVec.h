@@ -0,0 +1,169 @@
+#pragma once
+
+// small float vector wrappers used by the lane-parallel dsp code.
+// Vec4 is always 4 wide (SSE or plain arrays), VecN is the widest type the
+// build targets: 8 lanes with /arch:AVX (or -mavx), 4 lanes otherwise.
+// Vec1 is a single float with the same interface, so the vector templates
+// (FastMath.h) also serve the scalar code.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define LM_SIMD_SSE 1
+#define LM_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LM_SIMD_SSE 1
+#endif
+
+#include <math.h>
+#include <string.h>
+
+struct Vec1
+{
+	constexpr static int Width = 1;
+	float v;
+
+	static inline Vec1 Load(const float* p) { return { *p }; }
+	static inline Vec1 LoadU(const float* p) { return { *p }; }
+	static inline Vec1 Set(float x) { return { x }; }
+	static inline Vec1 Zero() { return { 0.0f }; }
+	inline void Store(float* p) const { *p = v; }
+	inline void StoreU(float* p) const { *p = v; }
+
+	friend inline Vec1 operator+(Vec1 a, Vec1 b) { return { a.v + b.v }; }
+	friend inline Vec1 operator-(Vec1 a, Vec1 b) { return { a.v - b.v }; }
+	friend inline Vec1 operator*(Vec1 a, Vec1 b) { return { a.v * b.v }; }
+	friend inline Vec1 operator/(Vec1 a, Vec1 b) { return { a.v / b.v }; }
+	friend inline Vec1 operator-(Vec1 a) { return { -a.v }; }
+
+	static inline Vec1 Min(Vec1 a, Vec1 b) { return { b.v < a.v ? b.v : a.v }; }
+	static inline Vec1 Max(Vec1 a, Vec1 b) { return { b.v > a.v ? b.v : a.v }; }
+	static inline Vec1 Abs(Vec1 a) { return { fabsf(a.v) }; }
+	static inline Vec1 CopySign(Vec1 a, Vec1 b) { return { copysignf(a.v, b.v) }; }
+	// all bits set where a < b like the SSE compare, Select() blends with bit
+	// operations so data dependent choices never become branches
+	static inline Vec1 Less(Vec1 a, Vec1 b) { return FromBits(a.v < b.v ? ~0u : 0u); }
+	static inline Vec1 Select(Vec1 mask, Vec1 a, Vec1 b)
+	{
+		unsigned m = Bits(mask);
+		return FromBits((Bits(a) & m) | (Bits(b) & ~m));
+	}
+	static inline bool AnyTrue(Vec1 mask) { return Bits(mask) != 0; }
+
+	inline float Sum() const { return v; }
+private:
+	static inline unsigned Bits(Vec1 a) { unsigned u; memcpy(&u, &a.v, sizeof(u)); return u; }
+	static inline Vec1 FromBits(unsigned u) { Vec1 r; memcpy(&r.v, &u, sizeof(u)); return r; }
+};
+
+struct Vec4
+{
+	constexpr static int Width = 4;
+#if defined(LM_SIMD_SSE)
+	__m128 v;
+
+	static inline Vec4 Load(const float* p) { return { _mm_load_ps(p) }; }
+	static inline Vec4 LoadU(const float* p) { return { _mm_loadu_ps(p) }; }
+	static inline Vec4 Set(float x) { return { _mm_set1_ps(x) }; }
+	static inline Vec4 Zero() { return { _mm_setzero_ps() }; }
+	inline void Store(float* p) const { _mm_store_ps(p, v); }
+	inline void StoreU(float* p) const { _mm_storeu_ps(p, v); }
+
+	friend inline Vec4 operator+(Vec4 a, Vec4 b) { return { _mm_add_ps(a.v, b.v) }; }
+	friend inline Vec4 operator-(Vec4 a, Vec4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+	friend inline Vec4 operator*(Vec4 a, Vec4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+	friend inline Vec4 operator/(Vec4 a, Vec4 b) { return { _mm_div_ps(a.v, b.v) }; }
+	friend inline Vec4 operator-(Vec4 a) { return { _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)) }; }
+
+	static inline Vec4 Min(Vec4 a, Vec4 b) { return { _mm_min_ps(a.v, b.v) }; }
+	static inline Vec4 Max(Vec4 a, Vec4 b) { return { _mm_max_ps(a.v, b.v) }; }
+	static inline Vec4 Abs(Vec4 a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+	// sign bit of b applied to a
+	static inline Vec4 CopySign(Vec4 a, Vec4 b)
+	{
+		__m128 sign = _mm_set1_ps(-0.0f);
+		return { _mm_or_ps(_mm_andnot_ps(sign, a.v), _mm_and_ps(sign, b.v)) };
+	}
+	// lane mask, all bits set where a < b
+	static inline Vec4 Less(Vec4 a, Vec4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	static inline Vec4 Select(Vec4 mask, Vec4 a, Vec4 b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+	static inline bool AnyTrue(Vec4 mask) { return _mm_movemask_ps(mask.v) != 0; }
+
+	inline float Sum() const
+	{
+		__m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+#else
+	float v[4];
+
+	static inline Vec4 Load(const float* p) { Vec4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+	static inline Vec4 LoadU(const float* p) { return Load(p); }
+	static inline Vec4 Set(float x) { Vec4 r; for (int i = 0; i < 4; ++i) r.v[i] = x; return r; }
+	static inline Vec4 Zero() { return Set(0.0f); }
+	inline void Store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+	inline void StoreU(float* p) const { Store(p); }
+
+	friend inline Vec4 operator+(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+	friend inline Vec4 operator-(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+	friend inline Vec4 operator*(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+	friend inline Vec4 operator/(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] /= b.v[i]; return a; }
+	friend inline Vec4 operator-(Vec4 a) { for (int i = 0; i < 4; ++i) a.v[i] = -a.v[i]; return a; }
+
+	static inline Vec4 Min(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]; return a; }
+	static inline Vec4 Max(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] = b.v[i] > a.v[i] ? b.v[i] : a.v[i]; return a; }
+	static inline Vec4 Abs(Vec4 a) { for (int i = 0; i < 4; ++i) a.v[i] = fabsf(a.v[i]); return a; }
+	static inline Vec4 CopySign(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] = copysignf(a.v[i], b.v[i]); return a; }
+	// lanes hold 1.0 where a < b, Select() treats any non-zero lane as true
+	static inline Vec4 Less(Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] < b.v[i] ? 1.0f : 0.0f; return a; }
+	static inline Vec4 Select(Vec4 mask, Vec4 a, Vec4 b) { for (int i = 0; i < 4; ++i) a.v[i] = mask.v[i] != 0.0f ? a.v[i] : b.v[i]; return a; }
+	static inline bool AnyTrue(Vec4 mask) { for (int i = 0; i < 4; ++i) if (mask.v[i] != 0.0f) return true; return false; }
+
+	inline float Sum() const { return (v[0] + v[2]) + (v[1] + v[3]); }
+#endif
+};
+
+#if defined(LM_SIMD_AVX)
+struct Vec8
+{
+	constexpr static int Width = 8;
+	__m256 v;
+
+	static inline Vec8 Load(const float* p) { return { _mm256_load_ps(p) }; }
+	static inline Vec8 LoadU(const float* p) { return { _mm256_loadu_ps(p) }; }
+	static inline Vec8 Set(float x) { return { _mm256_set1_ps(x) }; }
+	static inline Vec8 Zero() { return { _mm256_setzero_ps() }; }
+	inline void Store(float* p) const { _mm256_store_ps(p, v); }
+	inline void StoreU(float* p) const { _mm256_storeu_ps(p, v); }
+
+	friend inline Vec8 operator+(Vec8 a, Vec8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+	friend inline Vec8 operator-(Vec8 a, Vec8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	friend inline Vec8 operator*(Vec8 a, Vec8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	friend inline Vec8 operator/(Vec8 a, Vec8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+	friend inline Vec8 operator-(Vec8 a) { return { _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)) }; }
+
+	static inline Vec8 Min(Vec8 a, Vec8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+	static inline Vec8 Max(Vec8 a, Vec8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+	static inline Vec8 Abs(Vec8 a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+	static inline Vec8 CopySign(Vec8 a, Vec8 b)
+	{
+		__m256 sign = _mm256_set1_ps(-0.0f);
+		return { _mm256_or_ps(_mm256_andnot_ps(sign, a.v), _mm256_and_ps(sign, b.v)) };
+	}
+	static inline Vec8 Less(Vec8 a, Vec8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	static inline Vec8 Select(Vec8 mask, Vec8 a, Vec8 b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+	static inline bool AnyTrue(Vec8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+
+	inline float Sum() const
+	{
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+};
+using VecN = Vec8;
+#else
+using VecN = Vec4;
+#endif
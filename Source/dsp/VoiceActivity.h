@@ -0,0 +1,50 @@
+#pragma once
+
+// puts a voice to sleep once its exciter has finished and the string peak
+// stays below SleepThreshold for SleepHoldSamples, NoteOn wakes it again
+class VoiceActivity
+{
+private:
+	bool active = false;
+	int quietSamples = 0;
+	float level = 0;
+public:
+	constexpr static float SleepThreshold = 1e-4f; // about -80dB
+	constexpr static int SleepHoldSamples = 4096;
+
+	void Wake()
+	{
+		active = true;
+		quietSamples = 0;
+		level = 1.0f; // not rendered yet, count it as loud
+	}
+	// silences the voice at once, e.g. at the end of a steal fade
+	void Sleep()
+	{
+		active = false;
+		level = 0;
+	}
+	bool IsActive() const
+	{
+		return active;
+	}
+	// peak string amplitude of the last block
+	float GetLevel() const
+	{
+		return level;
+	}
+	// call once per rendered block with the block's peak string amplitude
+	void Update(float peak, bool excitationFinished, int numSamples)
+	{
+		level = peak;
+		if (peak < SleepThreshold && excitationFinished)
+		{
+			quietSamples += numSamples;
+			if (quietSamples >= SleepHoldSamples) active = false;
+		}
+		else
+		{
+			quietSamples = 0;
+		}
+	}
+};
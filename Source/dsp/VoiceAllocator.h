@@ -0,0 +1,216 @@
+#pragma once
+
+#include <vector>
+
+// note -> voice bookkeeping for LMEpianoPoly.
+// Voices that are sounding (held, released but still ringing, or fading out
+// after being stolen) are kept in an active list, everything else is free.
+// When more than 'polyphony' voices sound, the victim is picked among the
+// voices that are not fading already: released before held, then the quietest,
+// then the oldest. The victim fades out on its own voice while the new note
+// starts on a spare one, so the pool holds a few more voices than the
+// polyphony.
+class VoiceAllocator
+{
+private:
+	int noteVoice[128];
+	std::vector<int> voiceNote;
+	std::vector<unsigned> voiceAge;
+	std::vector<char> held, fading, listed;
+	std::vector<int> active;
+	int numActive = 0;
+	int numFading = 0;
+	int polyphony = 0;
+	unsigned clock = 0;
+
+	void Unmap(int voice)
+	{
+		int note = voiceNote[voice];
+		if (note >= 0 && noteVoice[note] == voice) noteVoice[note] = -1;
+		voiceNote[voice] = -1;
+	}
+	void SetFading(int voice, bool fade)
+	{
+		if (fading[voice] == fade) return;
+		fading[voice] = fade;
+		numFading += fade ? 1 : -1;
+	}
+	template<typename LevelFn>
+	int PickVictim(LevelFn level) const
+	{
+		int victim = -1;
+		float bestLevel = 0;
+		for (int i = 0; i < numActive; ++i)
+		{
+			int v = active[i];
+			if (fading[v]) continue;
+			if (victim < 0)
+			{
+				victim = v;
+				bestLevel = level(v);
+				continue;
+			}
+			if (held[v] != held[victim])
+			{
+				if (!held[v])
+				{
+					victim = v;
+					bestLevel = level(v);
+				}
+				continue;
+			}
+			float l = level(v);
+			if (l < bestLevel || (l == bestLevel && voiceAge[v] < voiceAge[victim]))
+			{
+				victim = v;
+				bestLevel = l;
+			}
+		}
+		return victim;
+	}
+public:
+	// allocates, numVoices includes the spare voices used for fading out
+	void Prepare(int numVoices, int polyphony)
+	{
+		this->polyphony = polyphony;
+		for (int i = 0; i < 128; ++i) noteVoice[i] = -1;
+		voiceNote.assign(numVoices, -1);
+		voiceAge.assign(numVoices, 0);
+		held.assign(numVoices, 0);
+		fading.assign(numVoices, 0);
+		listed.assign(numVoices, 0);
+		active.assign(numVoices, 0);
+		numActive = 0;
+		numFading = 0;
+		clock = 0;
+	}
+	// changing the polyphony never allocates, use StealExcess() to fade out
+	// the voices above a lowered limit
+	void SetPolyphony(int polyphony)
+	{
+		this->polyphony = polyphony;
+	}
+	// starts fading one voice while more than 'polyphony' voices sound,
+	// returns it or -1
+	template<typename LevelFn>
+	int StealExcess(LevelFn level)
+	{
+		if (numActive - numFading <= polyphony) return -1;
+		int victim = PickVictim(level);
+		if (victim >= 0)
+		{
+			SetFading(victim, true);
+			Unmap(victim);
+		}
+		return victim;
+	}
+	// sounding voice that plays note, -1 if there is none
+	int FindVoice(int note) const
+	{
+		int v = noteVoice[note];
+		return v >= 0 && listed[v] && !fading[v] ? v : -1;
+	}
+	// marks an already sounding voice as struck again
+	void Strike(int voice)
+	{
+		held[voice] = 1;
+		voiceAge[voice] = ++clock;
+	}
+	// picks a voice for a new note. 'victim' receives the voice that has to
+	// fade out to make room for it, or -1. A voice that has to be cut without
+	// fade (every spare voice is still fading) is returned itself.
+	// level(voice) returns the current peak level of a voice.
+	template<typename LevelFn>
+	int Allocate(int note, LevelFn level, int& victim)
+	{
+		victim = -1;
+		if (numActive - numFading >= polyphony)
+		{
+			victim = PickVictim(level);
+			if (victim >= 0)
+			{
+				SetFading(victim, true);
+				Unmap(victim);
+			}
+		}
+
+		// prefer the free voice that played this note last time
+		int voice = noteVoice[note];
+		if (voice < 0 || listed[voice])
+		{
+			voice = -1;
+			for (int v = 0; v < (int)listed.size(); ++v)
+				if (!listed[v])
+				{
+					voice = v;
+					break;
+				}
+		}
+		if (voice < 0)
+		{
+			// no spare voice left: cut the victim, or the oldest fading voice
+			voice = victim;
+			victim = -1;
+			if (voice < 0)
+			{
+				for (int i = 0; i < numActive; ++i)
+				{
+					int v = active[i];
+					if (fading[v] && (voice < 0 || voiceAge[v] < voiceAge[voice])) voice = v;
+				}
+			}
+			SetFading(voice, false);
+		}
+
+		Unmap(voice);
+		if (!listed[voice])
+		{
+			listed[voice] = 1;
+			active[numActive++] = voice;
+		}
+		voiceNote[voice] = note;
+		noteVoice[note] = voice;
+		held[voice] = 1;
+		voiceAge[voice] = ++clock;
+		return voice;
+	}
+	// note off, the voice keeps ringing until it is retired
+	void Release(int voice)
+	{
+		held[voice] = 0;
+	}
+	// removes a voice that went silent from the active list. Its note mapping
+	// stays, so the next strike of that note prefers the same voice
+	void Retire(int voice)
+	{
+		if (!listed[voice]) return;
+		listed[voice] = 0;
+		held[voice] = 0;
+		SetFading(voice, false);
+		for (int i = 0; i < numActive; ++i)
+		{
+			if (active[i] == voice)
+			{
+				active[i] = active[--numActive];
+				break;
+			}
+		}
+	}
+	int GetNumActive() const
+	{
+		return numActive;
+	}
+	int GetActive(int i) const
+	{
+		return active[i];
+	}
+	// note a sounding voice plays, -1 once it was stolen
+	int GetNote(int voice) const
+	{
+		return voiceNote[voice];
+	}
+	bool IsHeld(int voice) const
+	{
+		return held[voice] != 0;
+	}
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <type_traits>
+#include "DelayLine.h"
+#include "KeyTable.h"
+
+// runtime voice settings to compile-time constants: f is called with a
+// std::integral_constant holding the value, so a generic lambda instantiates
+// its body once per value and the per-sample code inside runs with the
+// string count / interpolation kernel as constants (loops over the strings
+// unroll, the kernel switch disappears). Voices pick their variant once per
+// block with these.
+template<typename F>
+inline void DispatchStrings(int strings, F&& f)
+{
+	switch (strings)
+	{
+	case 1: f(std::integral_constant<int, 1>()); break;
+	case 2: f(std::integral_constant<int, 2>()); break;
+	default: f(std::integral_constant<int, StringLayout::MaxStrings>()); break;
+	}
+}
+
+template<typename F>
+inline void DispatchInterpolation(Interpolation mode, F&& f)
+{
+	switch (mode)
+	{
+	case Interpolation::Linear: f(std::integral_constant<Interpolation, Interpolation::Linear>()); break;
+	case Interpolation::Thiran: f(std::integral_constant<Interpolation, Interpolation::Thiran>()); break;
+	case Interpolation::Sinc: f(std::integral_constant<Interpolation, Interpolation::Sinc>()); break;
+	default: f(std::integral_constant<Interpolation, Interpolation::Hermite>()); break;
+	}
+}
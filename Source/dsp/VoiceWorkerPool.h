@@ -0,0 +1,144 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include "SimdVec.h"
+
+// pre-spawned real-time worker threads that share the voice rendering of one
+// audio callback. Run() publishes a job in a single atomic word, workers and
+// the audio thread claim task indices from it with compare-exchange, so
+// dispatch never takes a lock and the audio thread never waits for a worker
+// that has not started a task yet (it simply renders the task itself).
+//
+// An idle worker spins for SpinTime, which covers the back to back Run()
+// calls of the render quanta of one callback, then parks in Thread::wait().
+// Run() wakes the parked workers, so between callbacks they leave their cores
+// to the rest of the system. A woken worker joins a job late by the wake-up
+// latency, the audio thread has started on the tasks by then.
+class VoiceWorkerPool
+{
+public:
+	typedef void (*TaskFn)(void* ctx, int task);
+private:
+	constexpr static double SpinTime = 50e-6; // seconds
+
+	class Worker : public juce::Thread
+	{
+	private:
+		VoiceWorkerPool& pool;
+	public:
+		std::atomic<bool> parked{ false };
+
+		Worker(VoiceWorkerPool& pool) : juce::Thread("LMEpiano voice worker"), pool(pool)
+		{
+		}
+		void run() override
+		{
+			auto idleSince = std::chrono::steady_clock::now();
+			while (!threadShouldExit())
+			{
+				if (pool.TryRunTask())
+				{
+					idleSince = std::chrono::steady_clock::now();
+					continue;
+				}
+				if (std::chrono::steady_clock::now() - idleSince < std::chrono::duration<double>(SpinTime))
+				{
+					Pause();
+					continue;
+				}
+				// Run() publishes the job before it looks at parked, so either it
+				// sees parked and notifies or HasTask() sees the job
+				parked.store(true);
+				if (!pool.HasTask() && !threadShouldExit()) wait(-1);
+				parked.store(false);
+				idleSince = std::chrono::steady_clock::now();
+			}
+		}
+	};
+
+	// [63:48] job id, [47:32] task count, [31:0] next unclaimed task
+	std::atomic<uint64_t> job{ 0 };
+	std::atomic<int> done{ 0 };
+	uint64_t jobId = 0;
+	// only written while every task of the previous job is finished
+	TaskFn fn = nullptr;
+	void* ctx = nullptr;
+
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	static inline void Pause()
+	{
+#if defined(LM_SIMD_SSE)
+		_mm_pause();
+#endif
+	}
+	bool HasTask() const
+	{
+		uint64_t s = job.load();
+		return (uint32_t)s < ((uint32_t)(s >> 32) & 0xffff);
+	}
+	bool TryRunTask()
+	{
+		uint64_t s = job.load(std::memory_order_acquire);
+		for (;;)
+		{
+			uint32_t next = (uint32_t)s;
+			uint32_t count = (uint32_t)(s >> 32) & 0xffff;
+			if (next >= count) return false;
+			if (job.compare_exchange_weak(s, s + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				fn(ctx, (int)next);
+				done.fetch_add(1, std::memory_order_release);
+				return true;
+			}
+		}
+	}
+public:
+	~VoiceWorkerPool()
+	{
+		Stop();
+	}
+	// spawns the workers, call from prepareToPlay
+	void Start(int numWorkers, int blockSize, double sampleRate)
+	{
+		Stop();
+		for (int i = 0; i < numWorkers; ++i)
+		{
+			workers.push_back(std::make_unique<Worker>(*this));
+			auto options = juce::Thread::RealtimeOptions{}.withApproximateAudioProcessingTime(blockSize, sampleRate);
+			if (!workers.back()->startRealtimeThread(options))
+				workers.back()->startThread(juce::Thread::Priority::highest);
+		}
+	}
+	void Stop()
+	{
+		for (auto& w : workers) w->signalThreadShouldExit();
+		for (auto& w : workers) w->notify();
+		for (auto& w : workers) w->stopThread(1000);
+		workers.clear();
+	}
+	int GetNumWorkers() const
+	{
+		return (int)workers.size();
+	}
+	// runs task(ctx, 0 .. numTasks-1) on the workers and the calling thread,
+	// returns once every task has finished
+	void Run(int numTasks, TaskFn task, void* taskCtx)
+	{
+		fn = task;
+		ctx = taskCtx;
+		done.store(0, std::memory_order_relaxed);
+		jobId++;
+		job.store(((jobId & 0xffff) << 48) | ((uint64_t)numTasks << 32));
+		for (auto& w : workers)
+			if (w->parked.load()) w->notify();
+
+		while (TryRunTask());
+		while (done.load(std::memory_order_acquire) < numTasks) Pause();
+	}
+};
@@ -0,0 +1,636 @@
+// timing tables of the dsp, "DspBench <name>" runs the benchmarks whose name
+// contains it. Numbers are the best of a few runs, run on an idle machine
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include "FastMath.h"
+#include "TestUtil.h"
+
+// fast chords on a warm poly: cost of every NoteOn() against the render of
+// one block, and against clearing the three delay lines of a voice the way
+// Reset() did before it became O(1). The FDTD engine's note on resets the
+// strings' grids and chooses new ones
+struct NoteOnTimes
+{
+	double noteOnSum = 0, noteOnMax = 0, renderSum = 0;
+	int notes = 0, renders = 0;
+};
+
+static NoteOnTimes TimeNoteOns(int engine, int block, int chords, int chordSize)
+{
+	auto p = std::make_unique<LMEpianoPoly>();
+	LMEpianoParams params;
+	params.engine = engine;
+	p->SetParams(params);
+	p->Prepare(48000.0f, block);
+	StereoBuffer out(block);
+
+	NoteOnTimes t;
+	for (int c = 0; c < chords; ++c)
+	{
+		int root = 36 + (c * 7) % 48;
+		for (int k = 0; k < chordSize; ++k)
+		{
+			Stopwatch w;
+			p->NoteOn(root + k * 3, 0.8f);
+			double s = w.Seconds();
+			t.noteOnSum += s;
+			t.noteOnMax = std::max(t.noteOnMax, s);
+			t.notes++;
+		}
+		for (int b = 0; b < 8; ++b)
+		{
+			Stopwatch w;
+			Render(*p, out, 0, block, block);
+			t.renderSum += w.Seconds();
+			t.renders++;
+		}
+		for (int k = 0; k < chordSize; ++k)
+			p->NoteOff(root + k * 3);
+	}
+	return t;
+}
+
+static void BenchNoteOn()
+{
+	const int block = 128;
+	const int chords = 200, chordSize = 10;
+	NoteOnTimes wg = TimeNoteOns(LMEpianoPoly::EngineWaveguide, block, chords, chordSize);
+	NoteOnTimes fd = TimeNoteOns(LMEpianoPoly::EngineFDTD, block, chords / 4, chordSize);
+
+	// 3 x DelayLine<48000>, one set per voice so the clear misses the cache
+	// like it did on a voice that hadn't played for a while
+	const int voices = 32;
+	std::vector<float> lines((size_t)voices * 3 * 48000, 1.0f);
+	double clearSum = 0, clearMax = 0;
+	for (int i = 0; i < chords * chordSize; ++i)
+	{
+		float* d = &lines[(size_t)(i % voices) * 3 * 48000];
+		Stopwatch t;
+		std::fill(d, d + 3 * 48000, 0.0f);
+		double s = t.Seconds();
+		clearSum += s;
+		clearMax = std::max(clearMax, s);
+	}
+
+	int n = wg.notes;
+	printf("  NoteOn()                  mean %7.2f us  max %7.2f us\n", wg.noteOnSum / n * 1e6, wg.noteOnMax * 1e6);
+	printf("  old Reset() buffer clear  mean %7.2f us  max %7.2f us\n", clearSum / n * 1e6, clearMax * 1e6);
+	printf("  render of a %d block      mean %7.2f us  (%d voices sounding)\n", block, wg.renderSum / wg.renders * 1e6, chordSize);
+	printf("  a %d note chord costs %.1f%% of a block (old reset: %.0f%%)\n", chordSize,
+		100.0 * wg.noteOnSum / chords / (wg.renderSum / wg.renders), 100.0 * clearSum / chords / (wg.renderSum / wg.renders));
+	printf("  FDTD NoteOn()             mean %7.2f us  max %7.2f us\n", fd.noteOnSum / fd.notes * 1e6, fd.noteOnMax * 1e6);
+}
+
+// cost per output sample against the host block size, 8 voices sounding.
+// Every block is rendered in quanta of at most 256 samples, so the cost
+// should stay flat from there up
+static void BenchBlockSizes()
+{
+	const int len = 96000;
+	std::vector<int> blocks;
+	std::vector<double> ns;
+	for (int block = 16; block <= 16384; block *= 2)
+	{
+		double best = 1e9;
+		for (int run = 0; run < 3; ++run)
+		{
+			LMEpianoPoly p;
+			p.SetParams(LMEpianoParams());
+			p.Prepare(48000.0f, block);
+			for (int k = 0; k < 8; ++k) p.NoteOn(40 + k * 5, 0.8f);
+			StereoBuffer warm(12000), out(len);
+			Render(p, warm, 0, warm.Size(), block);
+			Stopwatch t;
+			Render(p, out, 0, len, block);
+			best = std::min(best, t.Seconds());
+		}
+		blocks.push_back(block);
+		ns.push_back(best / len * 1e9);
+	}
+	double ref = ns[std::find(blocks.begin(), blocks.end(), 256) - blocks.begin()];
+	printf("  block   ns/sample   vs 256\n");
+	for (size_t i = 0; i < blocks.size(); ++i)
+		printf("  %5d   %9.1f   %6.2f\n", blocks[i], ns[i], ns[i] / ref);
+}
+
+// the delay line kernel before the masked one: wrap loops and three
+// modulos per read, smoothing on every write
+template<int MaxDelayLen>
+class ModuloDelayLine
+{
+private:
+	std::vector<float> dat = std::vector<float>(MaxDelayLen, 0.0f);
+	float out = 0;
+	float currentDelay = 0, targetDelay = 0, delayVelocity = 0;
+	int pos = 0;
+
+	inline float ReadSampleHermite(float delay)
+	{
+		float readPos = (float)pos - delay;
+		while (readPos < 0) readPos += MaxDelayLen;
+		while (readPos >= MaxDelayLen) readPos -= MaxDelayLen;
+		int i1 = (int)readPos;
+		float f = readPos - i1;
+		int i0 = (i1 - 1 + MaxDelayLen) % MaxDelayLen;
+		int i2 = (i1 + 1) % MaxDelayLen;
+		int i3 = (i1 + 2) % MaxDelayLen;
+		float y0 = dat[i0], y1 = dat[i1], y2 = dat[i2], y3 = dat[i3];
+		float c0 = y1;
+		float c1 = 0.5f * (y2 - y0);
+		float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+		float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+		return ((c3 * f + c2) * f + c1) * f + c0;
+	}
+public:
+	inline void SetDelayTime(float t)
+	{
+		targetDelay = t;
+		delayVelocity = 1.0f / 50;
+	}
+	inline float ReadSample()
+	{
+		return out;
+	}
+	inline void WriteSample(float val)
+	{
+		dat[pos] = val;
+		currentDelay += delayVelocity * (targetDelay - currentDelay);
+		out = ReadSampleHermite(currentDelay);
+		if (++pos >= MaxDelayLen) pos = 0;
+	}
+};
+
+// Hermite delay line alone, ns per sample: the old modulo kernel, the
+// masked kernel sample by sample and in ReadBlock()/WriteBlock() chunks of
+// 32, settled and with the delay gliding (a new target every 64 samples)
+static void BenchDelayLine()
+{
+	const int len = 1 << 20, chunk = 32;
+	std::vector<float> in(len), out(len);
+	unsigned seed = 1;
+	for (auto& x : in)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		x = (seed >> 9) / 4194304.0f - 1.0f;
+	}
+	auto Time = [&](auto&& body) {
+		double best = 1e9;
+		for (int run = 0; run < 5; ++run)
+		{
+			Stopwatch t;
+			body();
+			best = std::min(best, t.Seconds());
+		}
+		return best / len * 1e9;
+	};
+	auto Target = [](float delay, int n, bool glide) { return glide ? delay + 4.0f * sinf(n * 0.001f) : delay; };
+
+	printf("  delay    motion    modulo   masked   block %d\n", chunk);
+	for (float delay : { 40.3f, 183.7f, 1500.2f })
+		for (bool glide : { false, true })
+		{
+			double tOld = Time([&] {
+				auto d = std::make_unique<ModuloDelayLine<48000>>();
+				for (int n = 0; n < len; ++n)
+				{
+					if (n % 64 == 0) d->SetDelayTime(Target(delay, n, glide));
+					d->WriteSample(in[n]);
+					out[n] = d->ReadSample();
+				}
+			});
+			double tNew = Time([&] {
+				DelayLine d(2048);
+				for (int n = 0; n < len; ++n)
+				{
+					if (n % 64 == 0) d.SetDelayTime(Target(delay, n, glide));
+					d.WriteSample<Interpolation::Hermite>(in[n]);
+					out[n] = d.ReadSample();
+				}
+			});
+			double tBlock = Time([&] {
+				DelayLine d(2048);
+				for (int n = 0; n < len;)
+				{
+					if (n % 64 == 0) d.SetDelayTime(Target(delay, n, glide));
+					if (d.CanReadBlock(chunk))
+					{
+						d.ReadBlock(&out[n], chunk);
+						d.WriteBlock(&in[n], chunk);
+						n += chunk;
+						continue;
+					}
+					d.WriteSample<Interpolation::Hermite>(in[n]);
+					out[n] = d.ReadSample();
+					n++;
+				}
+			});
+			printf("  %6.1f   %-8s %7.2f  %7.2f  %7.2f\n", delay, glide ? "gliding" : "settled", tOld, tNew, tBlock);
+		}
+}
+
+// not a timing: tuning error in cents per key and interpolator, one string
+static void BenchTuning()
+{
+	const char* names[] = { "Linear", "Hermite", "Thiran", "Sinc" };
+	printf("  note     freq");
+	for (auto n : names) printf("  %7s", n);
+	printf("\n");
+	for (int note = 21; note <= 105; note += 12)
+	{
+		printf("  %4d  %7.1f", note, 440.0 * pow(2.0, (note - 69) / 12.0));
+		for (int m = 0; m < 4; ++m) printf("  %+7.1f", KeyTuningCents(note, (Interpolation)m));
+		printf("\n");
+	}
+}
+
+// accuracy against std::atan / std::tanh (double) and time per result
+// relative to atanf / tanhf, the table in FastMath.h
+template<typename F>
+static double NsPerResult(F f, const std::vector<float>& x)
+{
+	volatile float sink = 0;
+	double best = 1e9;
+	for (int run = 0; run < 5; ++run)
+	{
+		Stopwatch t;
+		float sum = 0;
+		for (int rep = 0; rep < 64; ++rep) sum += f(x);
+		sink = sink + sum;
+		best = std::min(best, t.Seconds());
+	}
+	return best / (64.0 * x.size()) * 1e9;
+}
+
+template<MathTier Tier, typename Fn>
+static float SumVec(const std::vector<float>& x, Fn fn)
+{
+	VecN acc = VecN::Zero();
+	for (size_t i = 0; i < x.size(); i += VecN::Width) acc = acc + fn(VecN::LoadU(&x[i]));
+	return acc.Sum();
+}
+
+template<MathTier Tier>
+static void FastMathRow(const char* name, const std::vector<float>& xa, const std::vector<float>& xt, double atanfNs, double tanhfNs)
+{
+	double ea = MaxError([](float x) { return Atan<Tier>(x); }, [](double x) { return atan(x); }, 1e4);
+	double et = MaxError([](float x) { return Tanh<Tier>(x); }, [](double x) { return tanh(x); }, 20);
+	double af = NsPerResult([](const std::vector<float>& x) { float s = 0; for (float v : x) s += Atan<Tier>(v); return s; }, xa);
+	double av = NsPerResult([](const std::vector<float>& x) { return SumVec<Tier>(x, [](VecN v) { return Atan<Tier>(v); }); }, xa);
+	double tf = NsPerResult([](const std::vector<float>& x) { float s = 0; for (float v : x) s += Tanh<Tier>(v); return s; }, xt);
+	double tv = NsPerResult([](const std::vector<float>& x) { return SumVec<Tier>(x, [](VecN v) { return Tanh<Tier>(v); }); }, xt);
+	printf("  %-7s  %7.2g  %5.2f  %5.2f     %7.2g  %5.2f  %5.2f\n", name, ea, af / atanfNs, av / atanfNs, et, tf / tanhfNs, tv / tanhfNs);
+}
+
+static void BenchFastMath()
+{
+	std::vector<float> xa(4096), xt(4096);
+	unsigned seed = 1;
+	for (size_t i = 0; i < xa.size(); ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		float u = (seed >> 9) / 4194304.0f - 1.0f;
+		xa[i] = u * u * u * 50.0f; // saturator and nlapf arguments, mostly small
+		xt[i] = u * 5.0f;
+	}
+	double atanfNs = NsPerResult([](const std::vector<float>& x) { float s = 0; for (float v : x) s += atanf(v); return s; }, xa);
+	double tanhfNs = NsPerResult([](const std::vector<float>& x) { float s = 0; for (float v : x) s += tanhf(v); return s; }, xt);
+	printf("  atanf %.2f ns, tanhf %.2f ns per result; time relative to them\n", atanfNs, tanhfNs);
+	printf("  tier     atan err  float  VecN      tanh err  float  VecN\n");
+	FastMathRow<MathTier::Low>("Low", xa, xt, atanfNs, tanhfNs);
+	FastMathRow<MathTier::Medium>("Medium", xa, xt, atanfNs, tanhfNs);
+	FastMathRow<MathTier::High>("High", xa, xt, atanfNs, tanhfNs);
+}
+
+// string loop filter, ns per filtered sample: the disperser and damper
+// cascade LoopFilter replaced against LoopFilter per sample and on VecN
+// lanes (ns per lane)
+static void BenchLoopFilter()
+{
+	std::vector<float> x(4096);
+	unsigned seed = 1;
+	for (auto& v : x)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		v = (seed >> 9) / 4194304.0f - 1.0f;
+	}
+	const float a = 0.9f, g = 0.995f, h = 0.25f;
+	CascadeLoopFilter<float> cascade(a, g, h);
+	LoopFilter<Vec1> loop;
+	LoopFilter<VecN> lanes;
+	loop.SetCoeffs(0, a, g, h);
+	lanes.SetCoeffs(VecN::Set(a), VecN::Set(g), VecN::Set(h));
+	double c = NsPerResult([&](const std::vector<float>& x) { float s = 0; for (float v : x) s += cascade.Process(v); return s; }, x);
+	double l = NsPerResult([&](const std::vector<float>& x) { float s = 0; for (float v : x) s += loop.Process(Vec1::Set(v)).v; return s; }, x);
+	double v = NsPerResult([&](const std::vector<float>& x) {
+		VecN acc = VecN::Zero();
+		for (size_t i = 0; i < x.size(); i += VecN::Width) acc = acc + lanes.Process(VecN::LoadU(&x[i]));
+		return acc.Sum();
+	}, x);
+	printf("  cascade   LoopFilter   VecN lane\n");
+	printf("  %7.2f   %10.2f   %9.2f\n", c, l, v);
+}
+
+// energy of x that is not a harmonic of f0 (least squares fit of every
+// harmonic below 0.45 fs), relative to the energy of x, in dB
+static double NonHarmonicDb(const std::vector<float>& x, double f0, double fs)
+{
+	int numH = (int)(0.45 * fs / f0), n = 1 + 2 * numH;
+	std::vector<double> ata((size_t)n * n, 0.0), atb(n, 0.0), col(n);
+	for (size_t i = 0; i < x.size(); ++i)
+	{
+		col[0] = 1;
+		for (int h = 1; h <= numH; ++h)
+		{
+			double w = 2 * M_PI * f0 * h * i / fs;
+			col[2 * h - 1] = cos(w);
+			col[2 * h] = sin(w);
+		}
+		for (int r = 0; r < n; ++r)
+		{
+			atb[r] += col[r] * x[i];
+			for (int c = 0; c < n; ++c) ata[(size_t)r * n + c] += col[r] * col[c];
+		}
+	}
+	// Gauss-Jordan, the system is well conditioned (near orthogonal columns)
+	for (int p = 0; p < n; ++p)
+		for (int r = 0; r < n; ++r)
+		{
+			if (r == p) continue;
+			double m = ata[(size_t)r * n + p] / ata[(size_t)p * n + p];
+			for (int c = 0; c < n; ++c) ata[(size_t)r * n + c] -= m * ata[(size_t)p * n + c];
+			atb[r] -= m * atb[p];
+		}
+	double total = 0, residual = 0;
+	for (size_t i = 0; i < x.size(); ++i)
+	{
+		double fit = atb[0] / ata[0];
+		for (int h = 1; h <= numH; ++h)
+		{
+			double w = 2 * M_PI * f0 * h * i / fs;
+			fit += atb[2 * h - 1] / ata[(size_t)(2 * h - 1) * n + 2 * h - 1] * cos(w) + atb[2 * h] / ata[(size_t)(2 * h) * n + 2 * h] * sin(w);
+		}
+		total += (double)x[i] * x[i];
+		residual += (x[i] - fit) * (x[i] - fit);
+	}
+	return 10 * log10(residual / total);
+}
+
+// the nonlinear stage of RigidStringWaveguide (SaturateOversampled(): nlapf
+// with its signal dependent coefficient, then the atan clip) at full
+// overdrive on sines, through Oversampler at each factor. Quality is the
+// aliased (non harmonic) energy of the output, CPU the whole poly with 8
+// voices at nlv 1 relative to 1x
+static void BenchOversampling()
+{
+	const double fs = 48000;
+	printf("  aliased energy in dB at amplitude 0.5 / 1 (string levels), CPU of the poly\n");
+	printf("  factor    3k 0.5    7k 0.5      3k 1      7k 1   ns/sample   CPU\n");
+	double base = 0;
+	for (int factor : { 1, 2, 4 })
+	{
+		printf("  %4dx ", factor);
+		const float sines[][2] = { { 0.5f, 3001.0f }, { 0.5f, 7001.0f }, { 1.0f, 3001.0f }, { 1.0f, 7001.0f } };
+		for (auto& sine : sines)
+		{
+			float amp = sine[0];
+			double f0 = sine[1];
+			Oversampler<Vec1> os;
+			os.SetFactor(factor);
+			Disperser nlapf;
+			nlapf.SetSampleRate((float)fs * factor);
+			auto stage = [&](Vec1 x) {
+				Vec1 a = Atan<RigidStringWaveguide::AtanTier>(x * x * x * Vec1::Set(8.0f)) * Vec1::Set(2.0 / M_PI);
+				nlapf.SetA(RigidStringWaveguide::NlapfAtRate(a, Vec1::Set((float)factor)).v);
+				x.v = nlapf.ProcessSample<RigidStringWaveguide::NlapfStages>(x.v);
+				return Atan<RigidStringWaveguide::AtanTier>(x * Vec1::Set(0.2f)) * Vec1::Set(5.0f);
+			};
+			std::vector<float> out(24000);
+			for (int i = 0; i < 4800 + (int)out.size(); ++i)
+			{
+				float y = os.Process(Vec1::Set(amp * sinf((float)(2 * M_PI * f0 * i / fs))), stage).v;
+				if (i >= 4800) out[i - 4800] = y;
+			}
+			printf("  %8.1f", NonHarmonicDb(out, f0, fs));
+		}
+
+		double best = 1e9;
+		const int len = 48000;
+		for (int run = 0; run < 3; ++run)
+		{
+			LMEpianoPoly p;
+			LMEpianoParams params;
+			params.nlv = 1;
+			params.oversampling = factor;
+			p.SetParams(params);
+			p.Prepare(48000.0f, 256);
+			for (int k = 0; k < 8; ++k) p.NoteOn(40 + k * 5, 1.0f);
+			StereoBuffer out(len);
+			Stopwatch t;
+			Render(p, out, 0, len, 256);
+			best = std::min(best, t.Seconds());
+		}
+		double ns = best / len * 1e9;
+		if (factor == 1) base = ns;
+		printf("   %9.1f  %5.2f\n", ns, ns / base);
+	}
+}
+
+// ns per output sample of a warm poly holding the given number of notes,
+// setup(p) runs before Prepare()
+template<typename Setup>
+static double PolyNs(const LMEpianoParams& params, int voices, Setup setup)
+{
+	const int len = 48000;
+	double best = 1e9;
+	for (int run = 0; run < 3; ++run)
+	{
+		LMEpianoPoly p;
+		LMEpianoParams held = params;
+		held.poly = voices > held.poly ? voices : held.poly;
+		p.SetParams(held);
+		setup(p);
+		p.Prepare(48000.0f, 256);
+		for (int k = 0; k < voices; ++k) p.NoteOn(28 + (k * 7) % 72, 0.8f);
+		StereoBuffer warm(12000), out(len);
+		Render(p, warm, 0, warm.Size(), 256);
+		Stopwatch t;
+		Render(p, out, 0, len, 256);
+		best = std::min(best, t.Seconds());
+	}
+	return best / len * 1e9;
+}
+
+// bank strings sample by sample against chunked (LMEpianoBank::SetChunked()),
+// held notes with settled delays
+static void BenchChunked()
+{
+	printf("  voices  os   per-sample     chunked   ratio   (ns/sample)\n");
+	for (int factor : { 1, 2 })
+	{
+		for (int voices : { 4, 16, 64 })
+		{
+			LMEpianoParams params;
+			params.oversampling = factor;
+			double plain = PolyNs(params, voices, [](LMEpianoPoly& p) { p.SetVoiceMode(LMEpianoPoly::VoicesBank); p.SetChunked(false); });
+			double chunked = PolyNs(params, voices, [](LMEpianoPoly& p) { p.SetVoiceMode(LMEpianoPoly::VoicesBank); p.SetChunked(true); });
+			printf("  %6d  %dx   %10.1f  %10.1f   %5.2f\n", voices, factor, plain, chunked, chunked / plain);
+		}
+	}
+}
+
+// "piano" string layout against "trichords" on left hand heavy material:
+// 16 held notes, 12 of them below C3 (3 single strings, 9 bichords), struck
+// with the hands alternating, ns per output sample
+static void BenchStringLayout()
+{
+	const int notes[] = { 24, 36, 43, 60, 26, 38, 45, 64, 28, 40, 47, 67, 31, 33, 35, 72 };
+	auto ns = [&](int engine, int layout) {
+		const int len = 48000;
+		double best = 1e9;
+		for (int run = 0; run < 3; ++run)
+		{
+			LMEpianoPoly p;
+			LMEpianoParams params;
+			params.engine = engine;
+			params.strings = layout;
+			params.poly = 16;
+			p.SetParams(params);
+			p.Prepare(48000.0f, 256);
+			for (int note : notes) p.NoteOn(note, 0.8f);
+			StereoBuffer warm(12000), out(len);
+			Render(p, warm, 0, warm.Size(), 256);
+			Stopwatch t;
+			Render(p, out, 0, len, 256);
+			best = std::min(best, t.Seconds());
+		}
+		return best / len * 1e9;
+	};
+	printf("  engine      trichords     piano   ratio   (ns/sample)\n");
+	for (int engine : { LMEpianoPoly::EngineWaveguide, LMEpianoPoly::EngineFDTD })
+	{
+		double tri = ns(engine, LMEpianoPoly::StringsTrichords), piano = ns(engine, LMEpianoPoly::StringsPiano);
+		printf("  %-9s  %10.1f  %8.1f   %5.2f\n", engine == LMEpianoPoly::EngineFDTD ? "fdtd" : "waveguide", tri, piano, piano / tri);
+	}
+}
+
+// ns per WaveguideLanes<VecN> step of W ringing strings interpolating with
+// mode, generic ProcessSample() or ProcessSample<W, Mode>()
+template<Interpolation Mode, bool Specialised>
+static double LaneStepNs()
+{
+	const int len = 200000;
+	double best = 1e9;
+	volatile float sink = 0;
+	for (int run = 0; run < 5; ++run)
+	{
+		WaveguideLanes<VecN> str;
+		str.Prepare(48000.0f, LMEpianoPoly::LowestFreq);
+		for (int l = 0; l < VecN::Width; ++l)
+		{
+			str.SetParams(l, 100.0f + 30.0f * l, 0.3f, 0.1f, 0.01f, 0.25f);
+			str.SetInterpolation(l, Mode);
+		}
+		VecN v = VecN::Set(0.5f);
+		for (int i = 0; i < 5000; ++i) v = str.ProcessSample(v * VecN::Set(0.99f));
+		Stopwatch t;
+		for (int i = 0; i < len; ++i)
+		{
+			VecN in = v * VecN::Set(0.99f) + VecN::Set(1e-3f);
+			if constexpr (Specialised) v = str.template ProcessSample<VecN::Width, Mode>(in);
+			else v = str.ProcessSample(in);
+		}
+		sink = sink + v.Sum();
+		best = std::min(best, t.Seconds());
+	}
+	return best / len * 1e9;
+}
+
+// bank group loop, generic against compiled per string count and
+// interpolation (LMEpianoBank::SetSpecialised()): the string step alone per
+// kernel, then the poly with held notes sample by sample and with the
+// default chunking (ns per output sample)
+static void BenchSpecialised()
+{
+	const char* names[] = { "Linear", "Hermite", "Thiran", "Sinc" };
+	printf("  kernel    generic  specialised   ratio   (ns per step of %d strings)\n", VecN::Width);
+	auto row = [&](Interpolation mode, double generic, double specialised) {
+		printf("  %-7s  %8.1f  %11.1f   %5.2f\n", names[(int)mode], generic, specialised, specialised / generic);
+	};
+	row(Interpolation::Linear, LaneStepNs<Interpolation::Linear, false>(), LaneStepNs<Interpolation::Linear, true>());
+	row(Interpolation::Hermite, LaneStepNs<Interpolation::Hermite, false>(), LaneStepNs<Interpolation::Hermite, true>());
+	row(Interpolation::Thiran, LaneStepNs<Interpolation::Thiran, false>(), LaneStepNs<Interpolation::Thiran, true>());
+	row(Interpolation::Sinc, LaneStepNs<Interpolation::Sinc, false>(), LaneStepNs<Interpolation::Sinc, true>());
+	printf("  quality  voices     generic  specialised   ratio   chunked: generic  specialised\n");
+	for (int quality : { LMEpianoPoly::QualityEco, LMEpianoPoly::QualityStandard })
+	{
+		for (int voices : { 4, 16, 64 })
+		{
+			LMEpianoParams params;
+			params.quality = quality;
+			double ns[2][2];
+			for (int chunked = 0; chunked < 2; ++chunked)
+			{
+				for (int specialised = 0; specialised < 2; ++specialised)
+				{
+					ns[chunked][specialised] = PolyNs(params, voices, [&](LMEpianoPoly& p) {
+						p.SetVoiceMode(LMEpianoPoly::VoicesBank);
+						p.SetChunked(chunked != 0);
+						p.SetSpecialised(specialised != 0);
+					});
+				}
+			}
+			printf("  %7d  %6d  %10.1f  %11.1f   %5.2f   %16.1f  %11.1f\n", quality, voices, ns[0][0], ns[0][1], ns[0][1] / ns[0][0], ns[1][0], ns[1][1]);
+		}
+	}
+}
+
+// all voices packed, all on the bank and VoicesAuto (the default: packed
+// while at most LMEpianoPoly::PackedVoices notes sound), ns per output
+// sample with held notes
+static void BenchVoiceModes()
+{
+	printf("  os  voices    packed      bank      auto\n");
+	for (int factor : { 1, 4 })
+	{
+		for (int voices : { 1, 2, 3, 4, 8, 16 })
+		{
+			LMEpianoParams params;
+			params.oversampling = factor;
+			double ns[3];
+			const int modes[] = { LMEpianoPoly::VoicesPacked, LMEpianoPoly::VoicesBank, LMEpianoPoly::VoicesAuto };
+			for (int m = 0; m < 3; ++m)
+				ns[m] = PolyNs(params, voices, [&](LMEpianoPoly& p) { p.SetVoiceMode(modes[m]); });
+			printf("  %dx  %6d  %8.1f  %8.1f  %8.1f\n", factor, voices, ns[0], ns[1], ns[2]);
+		}
+	}
+}
+
+static const struct
+{
+	const char* name;
+	void (*fn)();
+} benches[] = {
+	{ "NoteOn", BenchNoteOn },
+	{ "BlockSizes", BenchBlockSizes },
+	{ "DelayLine", BenchDelayLine },
+	{ "Tuning", BenchTuning },
+	{ "FastMath", BenchFastMath },
+	{ "LoopFilter", BenchLoopFilter },
+	{ "Oversampling", BenchOversampling },
+	{ "Chunked", BenchChunked },
+	{ "Specialised", BenchSpecialised },
+	{ "VoiceModes", BenchVoiceModes },
+	{ "StringLayout", BenchStringLayout },
+};
+
+int main(int argc, char** argv)
+{
+	for (auto& b : benches)
+	{
+		if (argc > 1 && !strstr(b.name, argv[1])) continue;
+		printf("%s\n", b.name);
+		b.fn();
+	}
+	return 0;
+}
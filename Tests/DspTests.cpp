@@ -0,0 +1,690 @@
+// checks of the dsp against its reference paths, exits with the number of
+// failed checks. "DspTests <name>" runs the tests whose name contains it
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include "FastMath.h"
+#include "TestUtil.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+	printf("  %s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static float Noise(unsigned& seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return (seed >> 9) / 4194304.0f - 1.0f;
+}
+
+// Reset() only forgets the samples written so far instead of clearing the
+// delay lines. A string reset after loud input must play exactly like one
+// reset after silence, whose delay line holds nothing but zeros (the delay
+// glides from the previous note either way)
+static void RenderReused(RigidStringWaveguide& str, Interpolation mode, float history, std::vector<float>& out)
+{
+	unsigned seed = 1;
+	str.Prepare(48000.0f, LMEpianoPoly::LowestFreq);
+	str.SetInterpolation(mode);
+	str.SetParams(65.4f, 0.5f, 0.5f, 0.1f, 0.25f);
+	for (int i = 0; i < 24000; ++i) str.ProcessSample(i < 2000 ? Noise(seed) * history : 0.0f);
+	str.Reset();
+	str.SetParams(523.3f, 0.2f, 0.3f, 0.25f, 0.25f);
+	for (int i = 0; i < (int)out.size(); ++i) out[i] = str.ProcessSample(i < 200 ? Noise(seed) : 0.0f);
+}
+
+static void RenderReused(WaveguideLanes<VecN>& str, Interpolation mode, float history, std::vector<float>& out)
+{
+	unsigned seed = 1;
+	str.Prepare(48000.0f, LMEpianoPoly::LowestFreq);
+	alignas(32) float x[VecN::Width];
+	for (int l = 0; l < VecN::Width; ++l)
+	{
+		str.SetInterpolation(l, mode);
+		str.SetParams(l, 65.4f + l, 0.5f, 0.5f, 0.1f, 0.25f);
+	}
+	for (int i = 0; i < 24000; ++i)
+	{
+		for (int l = 0; l < VecN::Width; ++l) x[l] = i < 2000 ? Noise(seed) : 0.0f;
+		x[0] *= history;
+		str.ProcessSample(VecN::Load(x));
+	}
+	// the other lanes keep sounding
+	str.Reset(0);
+	str.SetParams(0, 523.3f, 0.2f, 0.3f, 0.25f, 0.25f);
+	for (int i = 0; i < (int)out.size(); ++i)
+	{
+		for (int l = 0; l < VecN::Width; ++l) x[l] = i < 200 ? Noise(seed) : 0.0f;
+		str.ProcessSample(VecN::Load(x)).Store(x);
+		out[i] = x[0];
+	}
+}
+
+static void TestStringReset()
+{
+	const char* names[] = { "Linear", "Hermite", "Thiran", "Sinc" };
+	for (int m = 0; m < 4; ++m)
+	{
+		char what[96];
+		std::vector<float> silent(48000), loud(48000);
+		RigidStringWaveguide a, b;
+		RenderReused(a, (Interpolation)m, 0.0f, silent);
+		RenderReused(b, (Interpolation)m, 1.0f, loud);
+		snprintf(what, sizeof(what), "RigidStringWaveguide %s: reset after loud input == after silence", names[m]);
+		Check(Peak(silent) > 0.01f && MaxAbsDiff(silent, loud) == 0, what);
+
+		auto la = std::make_unique<WaveguideLanes<VecN>>(), lb = std::make_unique<WaveguideLanes<VecN>>();
+		RenderReused(*la, (Interpolation)m, 0.0f, silent);
+		RenderReused(*lb, (Interpolation)m, 1.0f, loud);
+		snprintf(what, sizeof(what), "WaveguideLanes %s: reset lane after loud input == after silence", names[m]);
+		Check(Peak(silent) > 0.01f && MaxAbsDiff(silent, loud) == 0, what);
+	}
+}
+
+// the FDTD engine over the whole cross range and the extremes of the other
+// parameters: the bridge coupling must never run away
+static void TestFdtdStable()
+{
+	const float fs = 48000;
+	auto p = std::make_unique<LMEpianoPoly>();
+	LMEpianoParams params;
+	params.engine = LMEpianoPoly::EngineFDTD;
+	params.poly = 4;
+	StereoBuffer out(12000);
+	int bad = 0, total = 0;
+	for (int layout : { LMEpianoPoly::StringsTrichords, LMEpianoPoly::StringsPiano })
+		for (float cross : { 0.0f, 0.25f, 0.5f, 0.75f, 1.0f })
+			for (float nlv : { 0.0f, 1.0f })
+				for (float disp : { 0.0f, 1.0f })
+				{
+					params.strings = layout;
+					params.cross = cross;
+					params.nlv = nlv;
+					params.disp = disp;
+					p->SetParams(params);
+					p->Prepare(fs, 256);
+					for (int note = 21; note <= 108; note += 12)
+					{
+						p->NoteOn(note, 1.0f);
+						Render(*p, out, 0, out.Size(), 256);
+						p->NoteOff(note);
+						bool ok = AllFinite(out.l) && Peak(out.l) < 100;
+						if (!ok && bad < 5) printf("  diverges: layout %d cross %.2f nlv %.0f disp %.0f note %d\n", layout, cross, nlv, disp, note);
+						bad += !ok;
+						total++;
+					}
+				}
+	char what[64];
+	snprintf(what, sizeof(what), "FDTD output stays finite (%d of %d settings)", total - bad, total);
+	Check(bad == 0, what);
+}
+
+// RigidStringFDTD::Reset() only clears the points the grids since the last
+// reset used. A string that played a low note (large grid) and was moved to
+// a high one (a parameter change, same note) must play the next note after
+// a reset exactly like a new string
+static void TestFdtdReset()
+{
+	const float fs = 48000;
+	std::vector<float> fresh(12000), reused(12000);
+	auto Play = [](RigidStringFDTD& str, float freq, std::vector<float>& out) {
+		str.SetParams(freq, 0.5f, 0.3f, 0.1f, 0.25f);
+		for (int i = 0; i < (int)out.size(); ++i) out[i] = str.ProcessSample(i < 100 ? 0.5f : 0.0f);
+	};
+	auto a = std::make_unique<RigidStringFDTD>(), b = std::make_unique<RigidStringFDTD>();
+	a->Prepare(fs);
+	b->Prepare(fs);
+	Play(*b, 27.5f, reused);
+	Play(*b, 1760.0f, reused);
+	b->Reset();
+	Play(*b, 55.0f, reused);
+	Play(*a, 55.0f, fresh);
+	Check(Peak(fresh) > 0.001f && MaxAbsDiff(fresh, reused) == 0, "FDTD string reset after a grid change == new string");
+}
+
+// SetParams() takes the FDTD grid from a closed form and one stability
+// test: it must pick the largest stable grid, found here by searching down
+// from MaxGrid with the same test, for every key +-48 semitones at three rates
+static void TestFdtdGrid()
+{
+	auto str = std::make_unique<RigidStringFDTD>();
+	int wrong = 0, total = 0;
+	for (float fs : { 44100.0f, 48000.0f, 96000.0f })
+	{
+		str->Prepare(fs);
+		double dt = 1.0f / fs;
+		for (int note = 0; note < 128; ++note)
+			for (int semi = -48; semi <= 48; semi += 6)
+				for (float disp : { 0.0f, 0.5f, 1.0f })
+				{
+					float freq = (float)(440.0 * pow(2.0, (note - 69 + semi) / 12.0));
+					double B = disp * freq / RigidStringFDTD::InharmonicityFreq;
+					B *= B;
+					double x = (1.0 - cos(2.0 * M_PI * freq * dt)) / 2.0;
+					int expect = RigidStringFDTD::MinGrid;
+					for (int n = RigidStringFDTD::MaxGrid; n > RigidStringFDTD::MinGrid; --n)
+					{
+						double t = sin(M_PI / (2.0 * n)), beta = B * n * n / (M_PI * M_PI);
+						double s = x / (t * t * (1.0 + 4.0 * beta * t * t));
+						if ((float)s + 4.0f * (float)(s * beta) <= 0.75f)
+						{
+							expect = n;
+							break;
+						}
+					}
+					str->SetParams(freq, disp, 0.0f, 0.1f, 0.25f);
+					if (str->GetGridSize() != expect && wrong < 5) printf("  %.0f Hz note %d %+d disp %.1f: grid %d, expected %d\n", fs, note, semi, disp, str->GetGridSize(), expect);
+					wrong += str->GetGridSize() != expect;
+					total++;
+				}
+	}
+	char what[64];
+	snprintf(what, sizeof(what), "FDTD grid is the largest stable one (%d of %d)", total - wrong, total);
+	Check(wrong == 0, what);
+}
+
+// the FDTD grid and coefficients are solved per key so the lowest mode sits
+// on the key: pins that tuning for every third key at both common rates. One voice
+// (a new note steals the last) and no sustain damping, so the string rings
+// well past the hammer. The bridge of the three unison strings pulls the
+// fundamental by a few cents
+static void TestFdtdPitch()
+{
+	for (float fs : { 44100.0f, 48000.0f })
+	{
+		auto p = std::make_unique<LMEpianoPoly>();
+		LMEpianoParams params;
+		params.engine = LMEpianoPoly::EngineFDTD;
+		params.poly = 1;
+		params.unison = 0;
+		params.damp_base = 0;
+		p->SetParams(params);
+		p->Prepare(fs, 256);
+		StereoBuffer out(4800 + 16384);
+		double worst = 0;
+		int worstNote = 0;
+		for (int note = 21; note <= 108; note += 3)
+		{
+			p->NoteOn(note, 1.0f);
+			Render(*p, out, 0, out.Size(), 256);
+			p->NoteOff(note);
+			double f = 440.0 * pow(2.0, (note - 69) / 12.0);
+			double cents = 1200 * log2(PeakFrequency(out.l, 4800, 16384, fs, f) / f);
+			if (fabs(cents) > worst)
+			{
+				worst = fabs(cents);
+				worstNote = note;
+			}
+		}
+		char what[96];
+		snprintf(what, sizeof(what), "%.0f Hz: FDTD keys 21-108 within 10 cents (worst %.1f at %d)", fs, worst, worstNote);
+		Check(worst < 10, what);
+	}
+}
+
+// voices rendered on worker threads are mixed in task order, the output
+// must not depend on the number of threads. Between jobs the workers park
+// instead of spinning: the process uses next to no cpu while they wait
+static void TestRenderThreads()
+{
+	const int len = 48000;
+	StereoBuffer ref(len);
+	{
+		LMEpianoPoly p;
+		p.SetParams(LMEpianoParams());
+		p.Prepare(48000.0f, 512);
+		PlayScript(p, ref, 512);
+	}
+	for (int threads : { 1, 3 })
+	{
+		LMEpianoPoly p;
+		LMEpianoParams params;
+		params.threads = threads;
+		p.SetParams(params);
+		Check(p.NeedsPrepare(), "a new thread count asks for Prepare()");
+		p.Prepare(48000.0f, 512);
+		Check(!p.NeedsPrepare(), "Prepare() starts the threads");
+		StereoBuffer out(len);
+		PlayScript(p, out, 512);
+		char what[64];
+		snprintf(what, sizeof(what), "%d render threads give the same output", threads);
+		Check(Peak(ref.l) > 0.01f && MaxAbsDiff(ref.l, out.l) == 0 && MaxAbsDiff(ref.r, out.r) == 0, what);
+
+		clock_t cpu = clock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		double busy = (double)(clock() - cpu) / CLOCKS_PER_SEC;
+		snprintf(what, sizeof(what), "%d idle render threads park (%.1f ms cpu in 200 ms)", threads, busy * 1000);
+		Check(busy < 0.02, what);
+	}
+}
+
+// a host faster than the engine rate goes through the resampler: the pitch
+// stays and its latency is reported
+static void TestInternalRate()
+{
+	LMEpianoPoly p;
+	LMEpianoParams params;
+	params.unison = 0;
+	params.damp_base = 0;
+	p.SetParams(params);
+	p.Prepare(96000.0f, 512);
+	Check(p.GetLatencySamples() == 0, "no latency at the host rate");
+	params.internalRate = 48000;
+	p.SetParams(params);
+	Check(p.NeedsPrepare(), "a new engine rate asks for Prepare()");
+	p.Prepare(96000.0f, 512);
+	Check(!p.NeedsPrepare(), "Prepare() switches the engine rate");
+	Check(p.GetLatencySamples() == Resampler::Taps, "resampler latency in host samples");
+
+	StereoBuffer out(96000);
+	p.NoteOn(69, 0.8f);
+	Render(p, out, 0, out.Size(), 512);
+	double cents = 1200 * log2(PeakFrequency(out.l, 9600, 65536, 96000, 440.0) / 440.0);
+	char what[64];
+	snprintf(what, sizeof(what), "A4 plays 440 Hz through the resampler (%+.1f cents)", cents);
+	Check(fabs(cents) < 2, what);
+
+	p.Prepare(44100.0f, 512);
+	Check(p.GetLatencySamples() == 0 && !p.NeedsPrepare(), "a slower host renders at its own rate");
+}
+
+// host blocks of any size are rendered in quanta of at most 256 samples,
+// neither the host block nor the prepared size may change the output
+static void TestBlockSizes()
+{
+	const int len = 48000;
+	StereoBuffer ref(len);
+	{
+		LMEpianoPoly p;
+		p.SetParams(LMEpianoParams());
+		p.Prepare(48000.0f, 256);
+		PlayScript(p, ref, 256);
+	}
+	const int sizes[][2] = { { 16, 16 }, { 100, 128 }, { 333, 512 }, { 4096, 4096 }, { 16384, 16384 }, { 64, 16384 } };
+	for (auto& s : sizes)
+	{
+		LMEpianoPoly p;
+		p.SetParams(LMEpianoParams());
+		p.Prepare(48000.0f, s[1]);
+		StereoBuffer out(len);
+		PlayScript(p, out, s[0]);
+		char what[80];
+		snprintf(what, sizeof(what), "blocks of %d, prepared for %d: same output (diff %g)", s[0], s[1], MaxAbsDiff(ref.l, out.l));
+		Check(Peak(ref.l) > 0.01f && MaxAbsDiff(ref.l, out.l) == 0 && MaxAbsDiff(ref.r, out.r) == 0, what);
+	}
+}
+
+// the bank renders its strings in chunks where the delays allow it, the
+// output must be the one of the per-sample loop
+static void TestBankChunked()
+{
+	const int len = 48000;
+	LMEpianoParams sets[3];
+	sets[1].nlv = 0.3f;
+	sets[1].oversampling = 2;
+	sets[2].quality = LMEpianoPoly::QualityHigh;
+	for (auto& params : sets)
+	{
+		StereoBuffer ref(len), out(len);
+		for (bool chunked : { false, true })
+		{
+			LMEpianoPoly p;
+			p.SetParams(params);
+			p.SetChunked(chunked);
+			p.Prepare(48000.0f, 512);
+			PlayScript(p, chunked ? out : ref, 512);
+		}
+		char what[96];
+		snprintf(what, sizeof(what), "nlv %.1f, %dx, quality %d: chunked output is the per-sample output", params.nlv, params.oversampling, params.quality);
+		Check(Peak(ref.l) > 0.01f && MaxAbsDiff(ref.l, out.l) == 0 && MaxAbsDiff(ref.r, out.r) == 0, what);
+	}
+}
+
+// one key on LMEpianoPacked (all strings in one simd pass) and on the scalar
+// LMEpiano, for every string count and interpolation
+template<typename Voice>
+static void RenderKey(Voice& voice, int strings, Interpolation mode, float nlv, std::vector<float>& out)
+{
+	voice.Prepare(48000.0f, LMEpianoPoly::LowestFreq);
+	voice.Reset();
+	voice.SetStringCount(strings);
+	voice.SetInterpolation(mode);
+	voice.SetStringParams(196.0f, 0.4f, nlv, 0.35f, 0.5f, 0.05f, 0.25f);
+	voice.NoteOn(0.8f);
+	std::vector<float> r(out.size());
+	voice.ProcessBlock(out.data(), r.data(), (int)out.size());
+}
+
+static void TestPackedVoice()
+{
+	const int len = 24000;
+	for (float nlv : { 0.0f, 0.5f })
+	{
+		for (int strings = 1; strings <= 3; ++strings)
+		{
+			float worst = 0, peak = 0;
+			for (Interpolation mode : { Interpolation::Linear, Interpolation::Hermite, Interpolation::Thiran, Interpolation::Sinc })
+			{
+				auto packed = std::make_unique<LMEpianoPacked>();
+				auto scalar = std::make_unique<LMEpiano>();
+				std::vector<float> a(len), b(len);
+				RenderKey(*packed, strings, mode, nlv, a);
+				RenderKey(*scalar, strings, mode, nlv, b);
+				peak = fmaxf(peak, Peak(b));
+				worst = fmaxf(worst, MaxAbsDiff(a, b));
+			}
+			char what[96];
+			snprintf(what, sizeof(what), "nlv %.1f, %d string(s): packed matches the scalar voice (diff %g)", nlv, strings, worst);
+			Check(peak > 0.01f && worst == 0, what);
+		}
+	}
+}
+
+// VoicesAuto plays the first PackedVoices notes on packed voices, the next
+// note moves them into the bank mid-note. Every voice sounds the same on
+// both, only the order of the mix differs from all-bank and all-packed
+// rendering
+static void TestVoiceModes()
+{
+	const int block = 256, blocks = 40;
+	StereoBuffer chord[2] = { StereoBuffer(block * blocks), StereoBuffer(block * blocks) };
+	int packed[4];
+	for (int m = 0; m < 2; ++m)
+	{
+		LMEpianoPoly p;
+		p.SetParams(LMEpianoParams());
+		p.SetVoiceMode(m == 0 ? LMEpianoPoly::VoicesBank : LMEpianoPoly::VoicesAuto);
+		p.Prepare(48000.0f, block);
+		for (int b = 0; b < blocks; ++b)
+		{
+			if (b % 8 == 0 && b / 8 < 4)
+			{
+				p.NoteOn(60 + b / 8 * 3, 0.7f);
+				if (m == 1) packed[b / 8] = p.GetNumPackedVoices();
+			}
+			p.ProcessBlock(&chord[m].l[b * block], &chord[m].r[b * block], block);
+		}
+	}
+	Check(packed[0] == 1 && packed[1] == 2 && packed[2] == 0 && packed[3] == 0, "two packed voices, then all of them on the bank");
+	float chordPeak = Peak(chord[0].l);
+	char what[96];
+	snprintf(what, sizeof(what), "packed voices continue on the bank (diff %.1e of the peak)", MaxAbsDiff(chord[0].l, chord[1].l) / chordPeak);
+	Check(chordPeak > 0.01f && MaxAbsDiff(chord[0].l, chord[1].l) < 1e-5f * chordPeak, what);
+
+	const int len = 48000;
+	StereoBuffer out[3] = { StereoBuffer(len), StereoBuffer(len), StereoBuffer(len) };
+	const int modes[] = { LMEpianoPoly::VoicesBank, LMEpianoPoly::VoicesPacked, LMEpianoPoly::VoicesAuto };
+	for (int m = 0; m < 3; ++m)
+	{
+		LMEpianoPoly q;
+		q.SetParams(LMEpianoParams());
+		q.SetVoiceMode(modes[m]);
+		Check(q.NeedsPrepare() == (modes[m] != LMEpianoPoly::VoicesAuto), "NeedsPrepare() follows the voice mode");
+		q.Prepare(48000.0f, 256);
+		PlayScript(q, out[m], 256);
+	}
+	float peak = Peak(out[0].l);
+	snprintf(what, sizeof(what), "packed output is the bank output (diff %.1e of the peak)", MaxAbsDiff(out[0].l, out[1].l) / peak);
+	Check(peak > 0.01f && MaxAbsDiff(out[0].l, out[1].l) < 1e-5f * peak, what);
+	snprintf(what, sizeof(what), "auto output is the bank output (diff %.1e of the peak)", MaxAbsDiff(out[0].l, out[2].l) / peak);
+	Check(MaxAbsDiff(out[0].l, out[2].l) < 1e-5f * peak, what);
+}
+
+// bank groups whose lanes share one interpolation run a loop compiled for it
+// and for the string count, the output must be the generic loop's. Chords of
+// a group's width in each register give uniform groups of every kernel, the
+// piano layout one and two string groups
+static void TestBankSpecialised()
+{
+	const int len = 24000;
+	for (int quality : { LMEpianoPoly::QualityEco, LMEpianoPoly::QualityHigh })
+	{
+		for (int layout : { LMEpianoPoly::StringsTrichords, LMEpianoPoly::StringsPiano })
+		{
+			StereoBuffer ref(len), out(len);
+			for (bool specialised : { false, true })
+			{
+				LMEpianoPoly p;
+				LMEpianoParams params;
+				params.quality = quality;
+				params.strings = layout;
+				params.poly = 4 * LMEpianoBank::W;
+				p.SetParams(params);
+				p.SetSpecialised(specialised);
+				p.Prepare(48000.0f, 256);
+				StereoBuffer& o = specialised ? out : ref;
+				const int lowest[] = { 21, 45, 69, 93 }; // one chord per register
+				for (int c = 0; c < 4; ++c)
+				{
+					for (int k = 0; k < LMEpianoBank::W; ++k) p.NoteOn(lowest[c] + k, 0.6f);
+					Render(p, o, c * len / 4, len / 4, 256);
+				}
+			}
+			char what[96];
+			snprintf(what, sizeof(what), "quality %d, string layout %d: specialised output is the generic output", quality, layout);
+			Check(Peak(ref.l) > 0.01f && MaxAbsDiff(ref.l, out.l) == 0 && MaxAbsDiff(ref.r, out.r) == 0, what);
+		}
+	}
+}
+
+// LoopFilter replaced the disperser and damper cascade: against the cascade
+// in double it must stay near the float cascade's own rounding (low-passed
+// noise, relative to the peak). The DC gain g sets the decay of the loop,
+// the recursions settle within an ulp of it (LoopFilter). Its lanes and its
+// block path must match the scalar filter exactly
+static void TestLoopFilter()
+{
+	const int len = 20000;
+	const float as[] = { 0.0f, 0.5f, 0.9f, 0.993f }, hs[] = { 0.0f, 0.25f, 0.9f };
+	const float g = 0.995f;
+	std::vector<float> x(len);
+	unsigned seed = 1;
+	float lp = 0;
+	for (auto& v : x) v = lp = 0.9f * lp + 0.1f * Noise(seed);
+	for (float a : as)
+	{
+		for (float h : hs)
+		{
+			CascadeLoopFilter<double> ref(a, g, h);
+			CascadeLoopFilter<float> cascade(a, g, h);
+			LoopFilter<Vec1> loop;
+			loop.SetCoeffs(0, a, g, h);
+			double peak = 0, cascadeErr = 0, loopErr = 0;
+			for (int i = 0; i < len; ++i)
+			{
+				double y = ref.Process(x[i]);
+				peak = fmax(peak, fabs(y));
+				cascadeErr = fmax(cascadeErr, fabs(cascade.Process(x[i]) - y));
+				loopErr = fmax(loopErr, fabs(loop.Process(Vec1::Set(x[i])).v - y));
+			}
+			float dc = 0;
+			for (int i = 0; i < len; ++i) dc = loop.Process(Vec1::Set(1.0f)).v;
+			char what[96];
+			snprintf(what, sizeof(what), "a %.3f h %.2f: error %.1e (cascade %.1e), dc gain %+.1e", a, h, loopErr / peak, cascadeErr / peak, dc / g - 1);
+			Check(loopErr / peak < 1e-5 && loopErr < 4 * cascadeErr + 1e-7 * peak && fabsf(dc / g - 1) < 4e-5f, what);
+		}
+	}
+
+	// lane l of a VecN filter gets its own coefficients
+	LoopFilter<VecN> lanes;
+	std::vector<LoopFilter<Vec1>> scalar(VecN::Width);
+	for (int l = 0; l < VecN::Width; ++l)
+	{
+		float a = as[l % 4], h = hs[l % 3];
+		lanes.SetCoeffs(l, a, g, h);
+		scalar[l].SetCoeffs(0, a, g, h);
+	}
+	bool lanesSame = true;
+	for (int i = 0; i < len; ++i)
+	{
+		alignas(32) float in[VecN::Width], out[VecN::Width];
+		for (int l = 0; l < VecN::Width; ++l) in[l] = x[(i + 37 * l) % len];
+		lanes.Process(VecN::Load(in)).Store(out);
+		for (int l = 0; l < VecN::Width; ++l) lanesSame &= out[l] == scalar[l].Process(Vec1::Set(in[l])).v;
+	}
+	Check(lanesSame, "every lane runs the scalar filter");
+}
+
+// ReadBlock()/WriteBlock() must produce what WriteSample() would, also
+// across the wrap of the buffer and while the delay still glides
+static void TestDelayLineBlocks()
+{
+	const int len = 20000, chunk = 32;
+	for (float delay : { 40.3f, 183.7f, 1500.2f })
+	{
+		unsigned seed = 1;
+		std::vector<float> in(len), ref(len), out(len);
+		for (auto& x : in) x = Noise(seed);
+		DelayLine a(2048), b(2048);
+		int blocks = 0;
+		for (int n = 0; n < len;)
+		{
+			if (n % 2000 == 0)
+			{
+				a.SetDelayTime(delay + n * 0.001f);
+				b.SetDelayTime(delay + n * 0.001f);
+			}
+			if (n + chunk <= len && b.CanReadBlock(chunk))
+			{
+				b.ReadBlock(&out[n], chunk);
+				b.WriteBlock(&in[n], chunk);
+				for (int k = 0; k < chunk; ++k)
+				{
+					a.WriteSample<Interpolation::Hermite>(in[n + k]);
+					ref[n + k] = a.ReadSample();
+				}
+				n += chunk;
+				blocks++;
+				continue;
+			}
+			a.WriteSample<Interpolation::Hermite>(in[n]);
+			ref[n] = a.ReadSample();
+			b.WriteSample<Interpolation::Hermite>(in[n]);
+			out[n] = b.ReadSample();
+			n++;
+		}
+		char what[80];
+		snprintf(what, sizeof(what), "delay %.1f: blocks match WriteSample() (%d blocks)", delay, blocks);
+		Check(blocks > 100 && MaxAbsDiff(ref, out) == 0, what);
+	}
+}
+
+// ComputeDelay() takes the loop filters and the one sample of bridge
+// feedback off the period, every key must sound at its frequency
+static void TestTuning()
+{
+	const char* names[] = { "Linear", "Hermite", "Thiran", "Sinc" };
+	for (int m = 0; m < 4; ++m)
+		for (int oversampling : { 1, 4 })
+		{
+			if (oversampling > 1 && m != (int)Interpolation::Hermite) continue;
+			double worst = 0;
+			for (int note = 21; note <= 105; note += 12)
+				worst = fmax(worst, fabs(KeyTuningCents(note, (Interpolation)m, oversampling)));
+			char what[80];
+			snprintf(what, sizeof(what), "%s %dx: keys within 4 cents (worst %.1f)", names[m], oversampling, worst);
+			Check(worst < 4, what);
+		}
+}
+
+// the lowest string the pitch parameter reaches (MIDI note 0 at MinPitch,
+// detuned down by full unison) keeps its loop length: an impulse comes back
+// after one period instead of a clamped delay
+static void TestLowestKey()
+{
+	const float fs = 48000;
+	float freq = 440.0f * powf(2.0f, (0 - 69 + LMEpianoPoly::MinPitch) / 12.0f) / 1.03f;
+	int period = (int)(fs / freq);
+	RigidStringWaveguide str;
+	str.Prepare(fs, LMEpianoPoly::LowestFreq);
+	str.SetParams(freq, 0, 0, 0, 0);
+	int echo = 0;
+	float best = 0;
+	for (int i = 0; i < period * 3 / 2; ++i)
+	{
+		float y = fabsf(str.ProcessSample(i == 0 ? 1.0f : 0.0f));
+		if (i > 64 && y > best)
+		{
+			best = y;
+			echo = i;
+		}
+	}
+	char what[96];
+	snprintf(what, sizeof(what), "%.3f Hz: echo after %d samples (period %d)", freq, echo, period);
+	Check(abs(echo - period) < period / 100, what);
+}
+
+// the error bounds FastMath.h documents per tier, and VecN giving the same
+// results as the float overload
+template<MathTier Tier>
+static void CheckTier(const char* name, double atanBound, double tanhBound)
+{
+	char what[96];
+	double ea = MaxError([](float x) { return Atan<Tier>(x); }, [](double x) { return atan(x); }, 1e4);
+	snprintf(what, sizeof(what), "Atan %s: max error %.3g <= %.2g", name, ea, atanBound);
+	Check(ea <= atanBound, what);
+	double et = MaxError([](float x) { return Tanh<Tier>(x); }, [](double x) { return tanh(x); }, 20);
+	snprintf(what, sizeof(what), "Tanh %s: max error %.3g <= %.2g", name, et, tanhBound);
+	Check(et <= tanhBound, what);
+
+	bool same = true;
+	alignas(32) float x[VecN::Width], ya[VecN::Width], yt[VecN::Width];
+	for (int i = -20000; i < 20000; i += VecN::Width)
+	{
+		for (int k = 0; k < VecN::Width; ++k) x[k] = (i + k) * 1e-3f;
+		Atan<Tier>(VecN::Load(x)).Store(ya);
+		Tanh<Tier>(VecN::Load(x)).Store(yt);
+		for (int k = 0; k < VecN::Width; ++k)
+			same = same && ya[k] == Atan<Tier>(x[k]) && yt[k] == Tanh<Tier>(x[k]);
+	}
+	snprintf(what, sizeof(what), "%s: VecN matches the float overload", name);
+	Check(same, what);
+	snprintf(what, sizeof(what), "%s: unity slope and odd symmetry at small signals", name);
+	Check(Atan<Tier>(1e-6f) == 1e-6f && Atan<Tier>(-0.3f) == -Atan<Tier>(0.3f) && Tanh<Tier>(-0.3f) == -Tanh<Tier>(0.3f), what);
+}
+
+static void TestFastMath()
+{
+	CheckTier<MathTier::Low>("Low", 1.4e-4, 1.0e-3);
+	CheckTier<MathTier::Medium>("Medium", 2.5e-6, 5.2e-6);
+	CheckTier<MathTier::High>("High", 1.4e-7, 3.8e-7);
+}
+
+static const struct
+{
+	const char* name;
+	void (*fn)();
+} tests[] = {
+	{ "StringReset", TestStringReset },
+	{ "FdtdStable", TestFdtdStable },
+	{ "FdtdReset", TestFdtdReset },
+	{ "FdtdGrid", TestFdtdGrid },
+	{ "FdtdPitch", TestFdtdPitch },
+	{ "RenderThreads", TestRenderThreads },
+	{ "InternalRate", TestInternalRate },
+	{ "BlockSizes", TestBlockSizes },
+	{ "BankChunked", TestBankChunked },
+	{ "BankSpecialised", TestBankSpecialised },
+	{ "PackedVoice", TestPackedVoice },
+	{ "VoiceModes", TestVoiceModes },
+	{ "LoopFilter", TestLoopFilter },
+	{ "DelayLineBlocks", TestDelayLineBlocks },
+	{ "Tuning", TestTuning },
+	{ "LowestKey", TestLowestKey },
+	{ "FastMath", TestFastMath },
+};
+
+int main(int argc, char** argv)
+{
+	for (auto& t : tests)
+	{
+		if (argc > 1 && !strstr(t.name, argv[1])) continue;
+		printf("%s\n", t.name);
+		t.fn();
+	}
+	printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+	return failures;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+// the few JUCE classes the dsp headers use, enough to build them without JUCE
+// for DspTests and DspBench. Thread runs on std::thread, the audio reader only
+// parses the 16-bit PCM WAV of BinaryData::Piano_IR_wav
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "BinaryData.h"
+
+namespace juce
+{
+	class InputStream
+	{
+	public:
+		virtual ~InputStream() {}
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+	};
+	class MemoryInputStream : public InputStream
+	{
+	public:
+		MemoryInputStream(const void* src, size_t numBytes, bool)
+		{
+			data = (const uint8_t*)src;
+			size = numBytes;
+		}
+	};
+	template<typename T>
+	class AudioBuffer
+	{
+	private:
+		int numChannels, numSamples;
+		std::vector<T> samples;
+	public:
+		AudioBuffer(int numChannels, int numSamples) : numChannels(numChannels), numSamples(numSamples), samples((size_t)numChannels * numSamples)
+		{
+		}
+		int getNumSamples() const { return numSamples; }
+		T* getWritePointer(int ch) { return &samples[(size_t)ch * numSamples]; }
+		const T* getReadPointer(int ch) const { return &samples[(size_t)ch * numSamples]; }
+	};
+	class AudioFormatReader
+	{
+	private:
+		const uint8_t* pcm = nullptr;
+		int numChannels = 1;
+	public:
+		int64_t lengthInSamples = 0;
+		AudioFormatReader(const uint8_t* pcm, int numChannels, int64_t length) : pcm(pcm), numChannels(numChannels), lengthInSamples(length)
+		{
+		}
+		// first channel only
+		bool read(AudioBuffer<float>* buffer, int startSample, int numSamples, int64_t readerStart, bool, bool)
+		{
+			float* out = buffer->getWritePointer(0) + startSample;
+			for (int i = 0; i < numSamples; ++i)
+			{
+				const uint8_t* p = pcm + ((readerStart + i) * numChannels) * 2;
+				out[i] = (int16_t)(p[0] | (p[1] << 8)) / 32768.0f;
+			}
+			return true;
+		}
+	};
+	class AudioFormatManager
+	{
+	private:
+		static uint32_t Read32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+	public:
+		void registerBasicFormats() {}
+		AudioFormatReader* createReaderFor(std::unique_ptr<InputStream> stream)
+		{
+			const uint8_t* d = stream->data;
+			size_t size = stream->size;
+			if (size < 12 || memcmp(d, "RIFF", 4) != 0 || memcmp(d + 8, "WAVE", 4) != 0) return nullptr;
+			int channels = 0, bits = 0;
+			for (size_t pos = 12; pos + 8 <= size;)
+			{
+				uint32_t len = Read32(d + pos + 4);
+				if (memcmp(d + pos, "fmt ", 4) == 0)
+				{
+					channels = d[pos + 10] | (d[pos + 11] << 8);
+					bits = d[pos + 22] | (d[pos + 23] << 8);
+				}
+				else if (memcmp(d + pos, "data", 4) == 0 && channels > 0 && bits == 16)
+				{
+					if (pos + 8 + len > size) len = (uint32_t)(size - pos - 8);
+					return new AudioFormatReader(d + pos + 8, channels, len / (2 * channels));
+				}
+				pos += 8 + len + (len & 1);
+			}
+			return nullptr;
+		}
+	};
+	class String
+	{
+	public:
+		String(const char*) {}
+	};
+	class Thread
+	{
+	private:
+		std::thread thread;
+		std::atomic<bool> shouldExit{ false };
+		// wait() and notify(): an auto-reset event like JUCE's
+		mutable std::mutex mutex;
+		mutable std::condition_variable cond;
+		mutable bool signalled = false;
+		void Launch()
+		{
+			shouldExit = false;
+			thread = std::thread([this] { run(); });
+		}
+	public:
+		enum class Priority { highest, high, normal, low, background };
+		struct RealtimeOptions
+		{
+			RealtimeOptions withApproximateAudioProcessingTime(int, double) const { return *this; }
+		};
+		Thread(const String&) {}
+		virtual ~Thread() { stopThread(-1); }
+		virtual void run() = 0;
+		bool startRealtimeThread(const RealtimeOptions&)
+		{
+			Launch();
+			return true;
+		}
+		bool startThread(Priority = Priority::normal)
+		{
+			Launch();
+			return true;
+		}
+		void signalThreadShouldExit() { shouldExit = true; }
+		bool threadShouldExit() const { return shouldExit; }
+		bool stopThread(int)
+		{
+			shouldExit = true;
+			notify();
+			if (thread.joinable()) thread.join();
+			return true;
+		}
+		// waits for notify() or timeOutMilliseconds (< 0 waits forever)
+		bool wait(double timeOutMilliseconds) const
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (timeOutMilliseconds < 0) cond.wait(lock, [this] { return signalled; });
+			else if (!cond.wait_for(lock, std::chrono::duration<double, std::milli>(timeOutMilliseconds), [this] { return signalled; })) return false;
+			signalled = false;
+			return true;
+		}
+		void notify() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			signalled = true;
+			cond.notify_all();
+		}
+		static void sleep(int ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+		static void yield() { std::this_thread::yield(); }
+	};
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <vector>
+#include "LMEpiano.h"
+
+// shared by DspTests and DspBench
+
+struct StereoBuffer
+{
+	std::vector<float> l, r;
+	StereoBuffer(int numSamples) : l(numSamples, 0.0f), r(numSamples, 0.0f)
+	{
+	}
+	int Size() const
+	{
+		return (int)l.size();
+	}
+};
+
+// renders [start, start + numSamples) of out in host blocks of blockSize
+inline void Render(LMEpianoPoly& p, StereoBuffer& out, int start, int numSamples, int blockSize)
+{
+	for (int n = start; n < start + numSamples; n += blockSize)
+	{
+		int len = start + numSamples - n < blockSize ? start + numSamples - n : blockSize;
+		p.ProcessBlock(&out.l[n], &out.r[n], len);
+	}
+}
+
+inline float MaxAbsDiff(const std::vector<float>& a, const std::vector<float>& b)
+{
+	float d = 0;
+	for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+		d = fmaxf(d, fabsf(a[i] - b[i]));
+	return d;
+}
+
+inline float Peak(const std::vector<float>& a)
+{
+	float p = 0;
+	for (float x : a) p = fmaxf(p, fabsf(x));
+	return p;
+}
+
+inline bool AllFinite(const std::vector<float>& a)
+{
+	for (float x : a)
+		if (!std::isfinite(x)) return false;
+	return true;
+}
+
+class Stopwatch
+{
+private:
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+public:
+	void Restart()
+	{
+		start = std::chrono::steady_clock::now();
+	}
+	double Seconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+// frequency of the strongest component within +-range cents of expect, from
+// a Hann windowed DFT in 0.5 cent steps over x[from, from + len)
+inline double PeakFrequency(const std::vector<float>& x, int from, int len, double sampleRate, double expect, double range = 150)
+{
+	std::vector<double> window(len);
+	for (int i = 0; i < len; ++i) window[i] = (0.5 - 0.5 * cos(2 * M_PI * i / len)) * x[from + i];
+	double best = -1, bestFreq = 0;
+	for (double c = -range; c <= range; c += 0.5)
+	{
+		double f = expect * pow(2.0, c / 1200), w = 2 * M_PI * f / sampleRate;
+		// Goertzel
+		double coeff = 2 * cos(w), s1 = 0, s2 = 0;
+		for (int i = 0; i < len; ++i)
+		{
+			double s0 = window[i] + coeff * s1 - s2;
+			s2 = s1;
+			s1 = s0;
+		}
+		double power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+		if (power > best)
+		{
+			best = power;
+			bestFreq = f;
+		}
+	}
+	return bestFreq;
+}
+
+// a fixed little performance over out.Size() samples: a rising line, a
+// chord wider than a bank group, a repeated note and releases, rendered in
+// host blocks of blockSize with every event on its own sample
+inline void PlayScript(LMEpianoPoly& p, StereoBuffer& out, int blockSize)
+{
+	struct Event
+	{
+		int time, note;
+		float velocity; // 0 releases the note
+	};
+	std::vector<Event> events;
+	for (int k = 0; k < 12; ++k)
+	{
+		events.push_back({ 1000 + k * 1500, 33 + k * 5, 0.3f + 0.05f * k });
+		if (k % 2 == 0) events.push_back({ 1900 + k * 1500, 33 + k * 5, 0 });
+	}
+	events.push_back({ 9001, 38, 0.9f });
+	for (int k = 0; k < 10; ++k) events.push_back({ 20000 + k * 7, 48 + k * 4, 0.7f });
+	for (int k = 0; k < 10; k += 3) events.push_back({ 26000 + k, 48 + k * 4, 0 });
+	std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.time < b.time; });
+
+	int pos = 0;
+	for (auto& e : events)
+	{
+		if (e.time >= out.Size()) break;
+		Render(p, out, pos, e.time - pos, blockSize);
+		pos = e.time;
+		if (e.velocity > 0) p.NoteOn(e.note, e.velocity);
+		else p.NoteOff(e.note);
+	}
+	Render(p, out, pos, out.Size() - pos, blockSize);
+}
+
+// tuning error in cents of one key played by a bank voice with a single
+// string (unison 0, no sustain damping, so the string rings well past the
+// hammer) and the given delay interpolation
+inline double KeyTuningCents(int note, Interpolation mode, int oversampling = 1, float sampleRate = 48000.0f)
+{
+	auto bank = std::make_unique<LMEpianoBank>();
+	bank->Prepare(LMEpianoBank::W, sampleRate, LMEpianoPoly::LowestFreq);
+	bank->SetOversampling(oversampling);
+	float freq = 440.0f * powf(2.0f, (note - 69) / 12.0f);
+	bank->SetStringCount(0, 1);
+	bank->SetStringParams(0, freq, 0, 0, 0.35f, 0, 0, 0.25f);
+	bank->SetInterpolation(0, mode);
+	bank->NoteOn(0, 0.8f);
+	StereoBuffer out(4800 + 32768);
+	bank->ProcessBlock(out.l.data(), out.r.data(), out.Size());
+	return 1200 * log2(PeakFrequency(out.l, 4800, 32768, sampleRate, freq) / freq);
+}
+
+// max absolute error of f against the double reference over [-range, range]:
+// a fine linear grid near 0 and a log grid of both signs out to the range
+template<typename F, typename R>
+inline double MaxError(F f, R ref, double range)
+{
+	double worst = 0;
+	auto Test = [&](double x) { worst = fmax(worst, fabs((double)f((float)x) - ref((double)(float)x))); };
+	for (int i = -200000; i <= 200000; ++i) Test(i * 1e-5 * (range < 2 ? range : 2));
+	for (int i = 0; i <= 400000; ++i)
+	{
+		double x = pow(10.0, -6.0 + i * (log10(range) + 6.0) / 400000);
+		Test(x);
+		Test(-x);
+	}
+	return worst;
+}
+
+// the string loop filter before LoopFilter: two Disperser stages of
+// coefficient a, then the damper y = (x + h x[-1]) / (1 + h) * g.
+// T = double gives the reference response
+template<typename T>
+struct CascadeLoopFilter
+{
+	T a, g, h;
+	T z0 = 0, z1 = 0, dz = 0;
+	CascadeLoopFilter(float a, float g, float h) : a(a), g(g), h(h)
+	{
+	}
+	inline T Process(T x)
+	{
+		T out = -a * x + z0;
+		z0 = x + a * out;
+		x = out;
+		out = -a * x + z1;
+		z1 = x + a * out;
+		x = out;
+		T y = (x + dz * h) / (1 + h) * g;
+		dz = x;
+		return y;
+	}
+};